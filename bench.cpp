@@ -0,0 +1,254 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring> // for memcpy
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <string>
+
+#include "try_signal.hpp"
+#include "copy.hpp"
+#include "search.hpp"
+
+#if !defined _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// prints one line of CSV per measurement:
+//
+//	benchmark,parameter,value,unit
+//
+// so results can be compared across runs
+
+namespace {
+
+int const calls_per_thread = 2000000;
+int const faults = 20000;
+
+using clock_type = std::chrono::steady_clock;
+
+double seconds_since(clock_type::time_point const start)
+{
+	return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+void report(char const* benchmark, std::string const& parameter
+	, double const value, char const* unit)
+{
+	std::printf("%s,%s,%.2f,%s\n", benchmark, parameter.c_str(), value, unit);
+}
+
+// an address we can't access. It's volatile to keep the compiler from warning
+// about the (intentional) invalid accesses
+char volatile* volatile const invalid_address = reinterpret_cast<char volatile*>(64);
+
+// the baseline for the protected calls. The call goes through a volatile
+// function pointer, to keep it from being inlined
+void increment(int volatile& sink) { sink = sink + 1; }
+void (* volatile plain_function)(int volatile&) = &increment;
+
+void bench_call_overhead()
+{
+	int volatile sink = 0;
+	auto start = clock_type::now();
+	for (int i = 0; i < calls_per_thread; ++i)
+		plain_function(sink);
+	report("plain_call", "", seconds_since(start) * 1e9 / calls_per_thread, "ns");
+
+	start = clock_type::now();
+	for (int i = 0; i < calls_per_thread; ++i)
+		sig::try_signal([&]{ plain_function(sink); });
+	report("empty_call", "", seconds_since(start) * 1e9 / calls_per_thread, "ns");
+}
+
+// the time from a fault, through the signal handler and back out of
+// try_signal_noexcept()
+template <typename Fun>
+double fault_round_trip(Fun f)
+{
+	auto const start = clock_type::now();
+	for (int i = 0; i < faults; ++i)
+		sig::try_signal_noexcept(f);
+	return seconds_since(start) * 1e9 / faults;
+}
+
+void bench_faults()
+{
+	char dest = 0;
+	report("fault_round_trip", "segmentation", fault_round_trip([&]{
+		dest = *invalid_address; }), "ns");
+	static_cast<void>(dest);
+
+#if !defined _WIN32
+	// a mapping extending past the end of the file raises SIGBUS on access
+	std::size_t const page = std::size_t(sysconf(_SC_PAGESIZE));
+	int const fd = open("bench_file", O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, off_t(page)) != 0) return;
+	char* const map = static_cast<char*>(mmap(nullptr, 2 * page, PROT_READ
+		, MAP_SHARED, fd, 0));
+	if (map != MAP_FAILED)
+	{
+		char volatile const* past_end = map + page;
+		report("fault_round_trip", "bus", fault_round_trip([&]{
+			dest = *past_end; }), "ns");
+		munmap(map, 2 * page);
+	}
+	close(fd);
+	unlink("bench_file");
+#endif
+}
+
+#if !defined _WIN32
+// copies a file (in the page cache) out of a mapping, in blocks of
+// block_size, with sig::copy() and with plain memcpy()
+void bench_copy()
+{
+	std::size_t const file_size = 64 * 1024 * 1024;
+	int const rounds = 8;
+
+	int const fd = open("bench_file", O_RDWR | O_CREAT | O_TRUNC, 0644);
+	std::vector<char> buffer(file_size, 'x');
+	if (fd < 0 || write(fd, buffer.data(), file_size) != ssize_t(file_size))
+	{
+		if (fd >= 0) close(fd);
+		return;
+	}
+	char* const map = static_cast<char*>(mmap(nullptr, file_size, PROT_READ
+		, MAP_SHARED, fd, 0));
+	close(fd);
+	unlink("bench_file");
+	if (map == MAP_FAILED) return;
+
+	std::size_t const block_sizes[] = { 4 * 1024, 64 * 1024, 1024 * 1024 };
+	for (std::size_t const block_size : block_sizes)
+	{
+		std::string const parameter = std::to_string(block_size);
+		for (int protect = 0; protect < 2; ++protect)
+		{
+			auto const start = clock_type::now();
+			for (int r = 0; r < rounds; ++r)
+			{
+				for (std::size_t i = 0; i < file_size; i += block_size)
+				{
+					if (protect) sig::copy(buffer.data() + i, map + i, block_size);
+					else std::memcpy(buffer.data() + i, map + i, block_size);
+				}
+			}
+			double const bytes = double(file_size) * rounds;
+			report(protect ? "protected_copy" : "memcpy", parameter
+				, bytes / seconds_since(start) / 1e6, "MB/s");
+		}
+
+		// copying and checksumming in one pass, against one pass each
+		for (int fused = 0; fused < 2; ++fused)
+		{
+			std::uint32_t crc = 0;
+			std::error_code ec;
+			auto const start = clock_type::now();
+			for (int r = 0; r < rounds; ++r)
+			{
+				for (std::size_t i = 0; i < file_size; i += block_size)
+				{
+					if (fused)
+					{
+						sig::copy_crc32c(buffer.data() + i, map + i, block_size, crc, ec);
+					}
+					else
+					{
+						sig::copy(buffer.data() + i, map + i, block_size);
+						crc = sig::crc32c(crc, buffer.data() + i, block_size);
+					}
+				}
+			}
+			double const bytes = double(file_size) * rounds;
+			report(fused ? "copy_crc32c" : "copy_then_crc32c", parameter
+				, bytes / seconds_since(start) / 1e6, "MB/s");
+		}
+	}
+
+	// scanning the whole file for a byte (and a pattern) that isn't in it
+	std::size_t volatile sink = 0;
+	for (int protect = 0; protect < 2; ++protect)
+	{
+		auto const start = clock_type::now();
+		for (int r = 0; r < rounds; ++r)
+		{
+			if (protect) sink = sig::find_byte(map, file_size, '\n').offset;
+			else sink = std::size_t(std::memchr(map, '\n', file_size) != nullptr);
+		}
+		report(protect ? "find_byte" : "memchr", ""
+			, double(file_size) * rounds / seconds_since(start) / 1e6, "MB/s");
+	}
+	char const pattern[] = "<record>";
+	for (int protect = 0; protect < 2; ++protect)
+	{
+		auto const start = clock_type::now();
+		for (int r = 0; r < rounds; ++r)
+		{
+			if (protect) sink = sig::find(map, file_size, pattern, 8).offset;
+			else sink = std::size_t(std::search(map, map + file_size, pattern, pattern + 8) - map);
+		}
+		report(protect ? "find" : "std_search", "8"
+			, double(file_size) * rounds / seconds_since(start) / 1e6, "MB/s");
+	}
+	static_cast<void>(sink);
+	munmap(map, file_size);
+}
+#endif
+
+// runs calls_per_thread empty protected calls on each of num_threads threads,
+// all started at the same time. Returns the wall clock time it took
+double run_threads(int const num_threads)
+{
+	std::atomic<int> ready(0);
+	std::atomic<bool> start(false);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; ++t)
+	{
+		threads.emplace_back([&]{
+			int volatile sink = 0;
+			++ready;
+			while (!start) std::this_thread::yield();
+			for (int i = 0; i < calls_per_thread; ++i)
+				sig::try_signal([&]{ sink = sink + 1; });
+		});
+	}
+	while (ready != num_threads) std::this_thread::yield();
+
+	auto const begin = clock_type::now();
+	start = true;
+	for (auto& t : threads) t.join();
+	return seconds_since(begin);
+}
+
+void bench_scaling()
+{
+	int const max_threads = std::max(1u, std::thread::hardware_concurrency());
+	for (int num_threads = 1;; num_threads *= 2)
+	{
+		if (num_threads > max_threads) num_threads = max_threads;
+		double const seconds = run_threads(num_threads);
+		double const calls = double(calls_per_thread) * num_threads;
+		report("thread_scaling", std::to_string(num_threads)
+			, calls / seconds, "calls/s");
+		if (num_threads == max_threads) break;
+	}
+}
+
+} // anonymous namespace
+
+int main()
+{
+	std::printf("benchmark,parameter,value,unit\n");
+	bench_call_overhead();
+	bench_faults();
+#if !defined _WIN32
+	bench_copy();
+#endif
+	bench_scaling();
+	return 0;
+}
@@ -0,0 +1,706 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+
+#include "copy.hpp"
+#include "try_signal.hpp"
+#include "simd.hpp"
+
+#if !defined _WIN32
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+namespace sig {
+
+namespace {
+
+// the copy kernels copy the range [done, len), front-to-back, one block at a
+// time. done is advanced after each block has been stored, so when a kernel
+// is interrupted by a fault, done is the offset of the block that failed
+using copy_kernel = void (*)(char* dst, char const* src, std::size_t len
+	, std::size_t volatile& done);
+
+// the largest block any of the kernels copy at a time
+std::size_t const max_block = 128;
+
+// copies larger than this bypass the cache in copy_to_mapped()
+std::size_t const non_temporal_threshold = 256 * 1024;
+
+void copy_scalar(char* dst, char const* src, std::size_t const len
+	, std::size_t volatile& done)
+{
+	std::size_t i = done;
+	for (; len - i >= 32; i += 32)
+	{
+		std::uint64_t block[4];
+		std::memcpy(block, src + i, sizeof(block));
+		std::memcpy(dst + i, block, sizeof(block));
+		// the block must be stored before we advance the progress
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + 32;
+	}
+	for (; i < len; ++i)
+	{
+		dst[i] = src[i];
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + 1;
+	}
+}
+
+#if TRY_SIGNAL_SSE2
+void copy_sse2(char* dst, char const* src, std::size_t const len
+	, std::size_t volatile& done)
+{
+	std::size_t i = done;
+	for (; len - i >= 64; i += 64)
+	{
+		__m128i const* s = reinterpret_cast<__m128i const*>(src + i);
+		__m128i* d = reinterpret_cast<__m128i*>(dst + i);
+		__m128i const a = _mm_loadu_si128(s);
+		__m128i const b = _mm_loadu_si128(s + 1);
+		__m128i const c = _mm_loadu_si128(s + 2);
+		__m128i const e = _mm_loadu_si128(s + 3);
+		_mm_storeu_si128(d, a);
+		_mm_storeu_si128(d + 1, b);
+		_mm_storeu_si128(d + 2, c);
+		_mm_storeu_si128(d + 3, e);
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + 64;
+	}
+	copy_scalar(dst, src, len, done);
+}
+
+void copy_stream_sse2(char* dst, char const* src, std::size_t const len
+	, std::size_t volatile& done)
+{
+	// non-temporal stores must be 16 byte aligned
+	std::size_t const head = (16 - reinterpret_cast<std::uintptr_t>(dst + done) % 16) % 16;
+	copy_scalar(dst, src, std::min(len, done + head), done);
+
+	std::size_t i = done;
+	for (; len - i >= 64; i += 64)
+	{
+		__m128i const* s = reinterpret_cast<__m128i const*>(src + i);
+		__m128i* d = reinterpret_cast<__m128i*>(dst + i);
+		__m128i const a = _mm_loadu_si128(s);
+		__m128i const b = _mm_loadu_si128(s + 1);
+		__m128i const c = _mm_loadu_si128(s + 2);
+		__m128i const e = _mm_loadu_si128(s + 3);
+		_mm_stream_si128(d, a);
+		_mm_stream_si128(d + 1, b);
+		_mm_stream_si128(d + 2, c);
+		_mm_stream_si128(d + 3, e);
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + 64;
+	}
+	_mm_sfence();
+	copy_scalar(dst, src, len, done);
+}
+#endif
+
+#if TRY_SIGNAL_AVX2
+__attribute__((target("avx2")))
+void copy_avx2(char* dst, char const* src, std::size_t const len
+	, std::size_t volatile& done)
+{
+	std::size_t i = done;
+	for (; len - i >= 128; i += 128)
+	{
+		__m256i const* s = reinterpret_cast<__m256i const*>(src + i);
+		__m256i* d = reinterpret_cast<__m256i*>(dst + i);
+		__m256i const a = _mm256_loadu_si256(s);
+		__m256i const b = _mm256_loadu_si256(s + 1);
+		__m256i const c = _mm256_loadu_si256(s + 2);
+		__m256i const e = _mm256_loadu_si256(s + 3);
+		_mm256_storeu_si256(d, a);
+		_mm256_storeu_si256(d + 1, b);
+		_mm256_storeu_si256(d + 2, c);
+		_mm256_storeu_si256(d + 3, e);
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + 128;
+	}
+	copy_sse2(dst, src, len, done);
+}
+#endif
+
+copy_kernel select_kernel()
+{
+#if TRY_SIGNAL_AVX2
+	if (detail::has_avx2()) return &copy_avx2;
+#endif
+#if TRY_SIGNAL_SSE2
+	return &copy_sse2;
+#else
+	return &copy_scalar;
+#endif
+}
+
+copy_kernel default_kernel()
+{
+	static copy_kernel const kernel = select_kernel();
+	return kernel;
+}
+
+// copies one byte at a time, through volatile pointers, to find the exact
+// offset of a fault
+void copy_bytes(char* dst, char const* src, std::size_t const end
+	, std::size_t volatile& done)
+{
+	char volatile* d = dst;
+	char const volatile* s = src;
+	for (std::size_t i = done; i < end; ++i)
+	{
+		d[i] = s[i];
+		done = i + 1;
+	}
+}
+
+// the outcome of rescued_copy()
+struct rescue_result
+{
+	std::error_code error;
+	// true if error is from a fault the byte-wise rescue ran into, in which
+	// case done is the offset of the byte that faulted. false if the rescue
+	// made no progress, meaning the fault wasn't in the copy itself
+	bool in_copy = false;
+};
+
+// runs copy() (which calls a kernel) under try_signal(), until it completes.
+// If it faults, the block that failed may have been partially copied.
+// rescue() copies it again, one byte at a time (with copy_bytes()), to find
+// out exactly how far we can get, advancing done. If rescue() faults too, or
+// makes no progress (so retrying would fault again, forever), the copy stops.
+// Otherwise the fault did not happen again, and copy() resumes where rescue()
+// stopped
+template <typename Copy, typename Rescue>
+rescue_result rescued_copy(std::size_t volatile& done, Copy copy, Rescue rescue)
+{
+	rescue_result ret;
+	for (;;)
+	{
+		ret.error = sig::try_signal_noexcept([&]{ copy(); });
+		if (!ret.error) return ret;
+
+		std::size_t const before = done;
+		std::error_code const ec = sig::try_signal_noexcept([&]{ rescue(); });
+		if (ec)
+		{
+			ret.error = ec;
+			ret.in_copy = true;
+			return ret;
+		}
+		if (done == before) return ret;
+	}
+}
+
+std::size_t protected_copy(copy_kernel const kernel, char* dst, char const* src
+	, std::size_t const len, std::error_code& ec)
+{
+	// this is updated by the kernel and read after a fault, it must not be
+	// cached in a register
+	std::size_t volatile done = 0;
+	ec = rescued_copy(done, [&]{ kernel(dst, src, len, done); }, [&]{
+#if TRY_SIGNAL_SSE2
+		// the kernel may have been left through the signal handler, with
+		// non-temporal stores still in flight. Order them before the stores of
+		// the byte-wise copy, and before we return to the caller
+		_mm_sfence();
+#endif
+		copy_bytes(dst, src, std::min(len, done + max_block), done);
+	}).error;
+	return ec ? std::size_t(done) : len;
+}
+
+// the CRC32C functions and kernels operate on the internal state of the
+// checksum, which is the bitwise complement of the checksum
+using crc_function = std::uint32_t (*)(std::uint32_t crc, char const* buf
+	, std::size_t len);
+
+// like copy_kernel, but also advances crc over each block, before advancing
+// done
+using crc_copy_kernel = void (*)(char* dst, char const* src, std::size_t len
+	, std::size_t volatile& done, std::uint32_t volatile& crc);
+
+// the reflected CRC32C polynomial
+std::uint32_t const crc32c_polynomial = 0x82f63b78;
+
+// the tables for the slicing-by-8 software implementation. table[0] is the
+// plain, byte-at-a-time, table
+struct crc32c_tables
+{
+	crc32c_tables()
+	{
+		for (std::uint32_t i = 0; i < 256; ++i)
+		{
+			std::uint32_t crc = i;
+			for (int k = 0; k < 8; ++k)
+				crc = (crc >> 1) ^ ((crc & 1) ? crc32c_polynomial : 0);
+			table[0][i] = crc;
+		}
+		for (int t = 1; t < 8; ++t)
+		{
+			for (int i = 0; i < 256; ++i)
+				table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xff];
+		}
+	}
+	std::uint32_t table[8][256];
+};
+
+crc32c_tables const& crc32c_table()
+{
+	static crc32c_tables const tables;
+	return tables;
+}
+
+// reads 4 bytes, little endian
+std::uint32_t load32(char const* buf)
+{
+	unsigned char const* b = reinterpret_cast<unsigned char const*>(buf);
+	return std::uint32_t(b[0]) | (std::uint32_t(b[1]) << 8)
+		| (std::uint32_t(b[2]) << 16) | (std::uint32_t(b[3]) << 24);
+}
+
+std::uint32_t crc32c_software(std::uint32_t crc, char const* buf, std::size_t len)
+{
+	std::uint32_t const (&t)[8][256] = crc32c_table().table;
+	for (; len >= 8; buf += 8, len -= 8)
+	{
+		std::uint32_t const lo = crc ^ load32(buf);
+		std::uint32_t const hi = load32(buf + 4);
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff]
+			^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+			^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff]
+			^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+	}
+	for (; len > 0; ++buf, --len)
+		crc = (crc >> 8) ^ t[0][(crc ^ static_cast<unsigned char>(*buf)) & 0xff];
+	return crc;
+}
+
+void copy_crc32c_software(char* dst, char const* src, std::size_t const len
+	, std::size_t volatile& done, std::uint32_t volatile& crc)
+{
+	std::size_t i = done;
+	std::uint32_t c = crc;
+	for (; len - i >= 32; i += 32)
+	{
+		// the checksum is computed over the copy in registers, rather than
+		// reading the destination back
+		std::uint64_t block[4];
+		std::memcpy(block, src + i, sizeof(block));
+		std::memcpy(dst + i, block, sizeof(block));
+		c = crc32c_software(c, reinterpret_cast<char const*>(block), sizeof(block));
+		std::atomic_signal_fence(std::memory_order_release);
+		crc = c;
+		done = i + 32;
+	}
+	for (; i < len; ++i)
+	{
+		char const b = src[i];
+		dst[i] = b;
+		c = crc32c_software(c, &b, 1);
+		std::atomic_signal_fence(std::memory_order_release);
+		crc = c;
+		done = i + 1;
+	}
+}
+
+#if TRY_SIGNAL_SSE42 || TRY_SIGNAL_ARM_CRC
+
+#if TRY_SIGNAL_SSE42
+#define TRY_SIGNAL_CRC_TARGET __attribute__((target("sse4.2")))
+#define TRY_SIGNAL_CRC64(crc, v) std::uint32_t(_mm_crc32_u64(crc, v))
+#define TRY_SIGNAL_CRC8(crc, v) _mm_crc32_u8(crc, v)
+#else
+#define TRY_SIGNAL_CRC_TARGET
+#define TRY_SIGNAL_CRC64(crc, v) __crc32cd(crc, v)
+#define TRY_SIGNAL_CRC8(crc, v) __crc32cb(crc, v)
+#endif
+
+TRY_SIGNAL_CRC_TARGET
+std::uint32_t crc32c_hardware(std::uint32_t crc, char const* buf, std::size_t len)
+{
+	for (; len >= 8; buf += 8, len -= 8)
+	{
+		std::uint64_t v;
+		std::memcpy(&v, buf, sizeof(v));
+		crc = TRY_SIGNAL_CRC64(crc, v);
+	}
+	for (; len > 0; ++buf, --len)
+		crc = TRY_SIGNAL_CRC8(crc, static_cast<unsigned char>(*buf));
+	return crc;
+}
+
+TRY_SIGNAL_CRC_TARGET
+void copy_crc32c_hardware(char* dst, char const* src, std::size_t const len
+	, std::size_t volatile& done, std::uint32_t volatile& crc)
+{
+	std::size_t i = done;
+	std::uint32_t c = crc;
+	for (; len - i >= 64; i += 64)
+	{
+		std::uint64_t block[8];
+		std::memcpy(block, src + i, sizeof(block));
+		std::memcpy(dst + i, block, sizeof(block));
+		for (std::uint64_t const v : block)
+			c = TRY_SIGNAL_CRC64(c, v);
+		std::atomic_signal_fence(std::memory_order_release);
+		crc = c;
+		done = i + 64;
+	}
+	for (; i < len; ++i)
+	{
+		char const b = src[i];
+		dst[i] = b;
+		c = TRY_SIGNAL_CRC8(c, static_cast<unsigned char>(b));
+		std::atomic_signal_fence(std::memory_order_release);
+		crc = c;
+		done = i + 1;
+	}
+}
+
+#undef TRY_SIGNAL_CRC_TARGET
+#undef TRY_SIGNAL_CRC64
+#undef TRY_SIGNAL_CRC8
+
+#endif
+
+bool crc32c_hardware_supported()
+{
+#if TRY_SIGNAL_SSE42
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+#elif TRY_SIGNAL_ARM_CRC
+	return true;
+#else
+	return false;
+#endif
+}
+
+struct crc32c_functions
+{
+	crc_function update;
+	crc_copy_kernel copy;
+};
+
+crc32c_functions select_crc32c()
+{
+#if TRY_SIGNAL_SSE42 || TRY_SIGNAL_ARM_CRC
+	if (crc32c_hardware_supported())
+		return crc32c_functions{&crc32c_hardware, &copy_crc32c_hardware};
+#endif
+	return crc32c_functions{&crc32c_software, &copy_crc32c_software};
+}
+
+crc32c_functions const& default_crc32c()
+{
+	static crc32c_functions const functions = select_crc32c();
+	return functions;
+}
+
+// the chunk size copy_hash() passes to the hash function. Small enough for
+// the chunk to still be in the L1 cache when it's hashed
+std::size_t const hash_chunk = 16 * 1024;
+
+// populates the ranges selected by flags, and returns the first error
+std::error_code populate_ranges(void* dst, void const* src, std::size_t const len
+	, std::uint32_t const flags)
+{
+	std::error_code ec;
+	if (flags & populate_source) ec = populate(src, len, false);
+	if (!ec && (flags & populate_destination)) ec = populate(dst, len, true);
+	return ec;
+}
+
+#if !defined _WIN32
+
+std::uintptr_t page_size()
+{
+	static std::uintptr_t const size = std::uintptr_t(sysconf(_SC_PAGESIZE));
+	return size;
+}
+
+#ifdef __linux__
+// MADV_POPULATE_READ and MADV_POPULATE_WRITE were added in linux 5.14. Older
+// kernels (and older headers) don't know about them
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+bool probe_populate()
+{
+	// kernels that don't support the advice fail with EINVAL. Try it on a page
+	// we know is mapped
+	static char probe = 0;
+	std::uintptr_t const page = reinterpret_cast<std::uintptr_t>(&probe)
+		& ~(page_size() - 1);
+	return madvise(reinterpret_cast<void*>(page), page_size(), MADV_POPULATE_READ) == 0
+		|| errno != EINVAL;
+}
+
+bool populate_supported()
+{
+	static bool const supported = probe_populate();
+	return supported;
+}
+#endif
+
+// mincore() fails with ENOMEM if any page in the range is not mapped
+std::error_code probe_mapped(char* start, std::size_t const len)
+{
+#ifdef __linux__
+	unsigned char residency[256];
+#else
+	char residency[256];
+#endif
+	std::size_t const chunk = sizeof(residency) * page_size();
+	for (std::size_t i = 0; i < len; i += chunk)
+	{
+		if (mincore(start + i, std::min(chunk, len - i), residency) != 0)
+			return std::error_code(errno, std::system_category());
+	}
+	return std::error_code();
+}
+
+#endif // _WIN32
+
+} // anonymous namespace
+
+std::error_code populate(void const* addr, std::size_t const len, bool const write)
+{
+#if defined _WIN32
+	static_cast<void>(addr);
+	static_cast<void>(len);
+	static_cast<void>(write);
+	return std::error_code();
+#else
+	if (len == 0) return std::error_code();
+
+	// madvise() and mincore() operate on whole pages
+	std::uintptr_t const begin = reinterpret_cast<std::uintptr_t>(addr)
+		& ~(page_size() - 1);
+	std::uintptr_t const end = (reinterpret_cast<std::uintptr_t>(addr) + len
+		+ page_size() - 1) & ~(page_size() - 1);
+	char* const start = reinterpret_cast<char*>(begin);
+
+#ifdef __linux__
+	if (populate_supported())
+	{
+		if (madvise(start, end - begin, write ? MADV_POPULATE_WRITE : MADV_POPULATE_READ) != 0)
+			return std::error_code(errno, std::system_category());
+		return std::error_code();
+	}
+#else
+	static_cast<void>(write);
+#endif
+	return probe_mapped(start, end - begin);
+#endif
+}
+
+std::size_t copy(void* dst, void const* src, std::size_t const len
+	, std::error_code& ec, std::uint32_t const flags)
+{
+	std::error_code const populate_error = populate_ranges(dst, src, len, flags);
+	std::size_t const n = protected_copy(default_kernel(), static_cast<char*>(dst)
+		, static_cast<char const*>(src), len, ec);
+	if (ec && populate_error) ec = populate_error;
+	return n;
+}
+
+std::size_t copy(void* dst, void const* src, std::size_t const len)
+{
+	std::error_code ec;
+	return copy(dst, src, len, ec);
+}
+
+std::size_t copy_to_mapped(void* dst, void const* src, std::size_t const len
+	, std::error_code& ec, std::uint32_t const flags)
+{
+#if TRY_SIGNAL_SSE2
+	if (len >= non_temporal_threshold)
+	{
+		std::error_code const populate_error = populate_ranges(dst, src, len, flags);
+		std::size_t const n = protected_copy(&copy_stream_sse2
+			, static_cast<char*>(dst), static_cast<char const*>(src), len, ec);
+		if (ec && populate_error) ec = populate_error;
+		return n;
+	}
+#endif
+	return copy(dst, src, len, ec, flags);
+}
+
+std::size_t copy_to_mapped(void* dst, void const* src, std::size_t const len)
+{
+	std::error_code ec;
+	return copy_to_mapped(dst, src, len, ec);
+}
+
+std::uint32_t crc32c(std::uint32_t const crc, void const* buf, std::size_t const len)
+{
+	return ~default_crc32c().update(~crc, static_cast<char const*>(buf), len);
+}
+
+std::size_t copy_crc32c(void* dst, void const* src, std::size_t const len
+	, std::uint32_t& crc, std::error_code& ec)
+{
+	crc32c_functions const& functions = default_crc32c();
+	char* const d = static_cast<char*>(dst);
+	char const* const s = static_cast<char const*>(src);
+
+	// the kernel advances state over each block before advancing done. The
+	// bytes copied by the rescue are checksummed from the destination, state
+	// covers the ones before checked
+	std::size_t volatile done = 0;
+	std::size_t volatile checked = 0;
+	std::uint32_t volatile state = ~crc;
+	ec = rescued_copy(done, [&]{ functions.copy(d, s, len, done, state); }, [&]{
+		checked = done;
+		copy_bytes(d, s, std::min(len, done + max_block), done);
+		state = functions.update(state, d + checked, done - checked);
+		checked = done;
+	}).error;
+	if (!ec)
+	{
+		crc = ~state;
+		return len;
+	}
+	crc = ~functions.update(state, d + checked, done - checked);
+	return done;
+}
+
+std::size_t copy_hash(void* dst, void const* src, std::size_t const len
+	, hash_function const& update, std::error_code& ec)
+{
+	copy_kernel const kernel = default_kernel();
+	char* const d = static_cast<char*>(dst);
+	char const* const s = static_cast<char const*>(src);
+
+	// done is the progress of the copy, hashed the number of bytes passed to
+	// update. Both are read after a fault
+	std::size_t volatile done = 0;
+	std::size_t volatile hashed = 0;
+	rescue_result const r = rescued_copy(done, [&]{
+		while (hashed < len)
+		{
+			std::size_t const end = std::min(len, hashed + hash_chunk);
+			kernel(d, s, end, done);
+			update(d + hashed, end - hashed);
+			hashed = end;
+		}
+	}, [&]{
+		// don't go past the chunk the kernel was copying
+		std::size_t const chunk_end = std::min(len, hashed + hash_chunk);
+		copy_bytes(d, s, std::min(chunk_end, done + max_block), done);
+	});
+	ec = r.error;
+	if (!ec) return len;
+	// if the fault wasn't in the copy, it was in update. Don't call it again
+	if (!r.in_copy) return hashed;
+	update(d + hashed, done - hashed);
+	return done;
+}
+
+#if !defined _WIN32
+copyv_result copyv(iovec const* dst, std::size_t const dst_count
+	, iovec const* src, std::size_t const src_count)
+{
+	copy_kernel const kernel = default_kernel();
+
+	// the position in both lists, and the progress of the kernel within the
+	// current piece (the overlap of the current segments). These are updated
+	// inside the protection scope and read after a fault, so they must not be
+	// cached in registers
+	std::size_t volatile di = 0;
+	std::size_t volatile doff = 0;
+	std::size_t volatile si = 0;
+	std::size_t volatile soff = 0;
+	std::size_t volatile total = 0;
+	std::size_t volatile done = 0;
+
+	auto piece = [&]() -> std::size_t {
+		return std::min(dst[di].iov_len - doff, src[si].iov_len - soff);
+	};
+	auto piece_dst = [&]{ return static_cast<char*>(dst[di].iov_base) + doff; };
+	auto piece_src = [&]{ return static_cast<char const*>(src[si].iov_base) + soff; };
+
+	// moves the position n bytes ahead, onto the next segments, if they've
+	// been completed
+	auto advance = [&](std::size_t const n) {
+		total = total + n;
+		doff = doff + n;
+		soff = soff + n;
+		done = 0;
+		if (doff == dst[di].iov_len) { di = di + 1; doff = 0; }
+		if (soff == src[si].iov_len) { si = si + 1; soff = 0; }
+	};
+
+	copyv_result ret;
+	rescue_result const r = rescued_copy(done, [&]{
+		while (di < dst_count && si < src_count)
+		{
+			std::size_t const n = piece();
+			kernel(piece_dst(), piece_src(), n, done);
+			advance(n);
+		}
+	}, [&]{
+		copy_bytes(piece_dst(), piece_src(), std::min(piece(), done + max_block), done);
+	});
+	ret.error = r.error;
+	if (r.in_copy)
+	{
+		// leave the position at the byte that failed. This never completes a
+		// segment, since that byte is in both of them
+		std::size_t const n = done;
+		total = total + n;
+		doff = doff + n;
+		soff = soff + n;
+	}
+
+	ret.bytes = total;
+	ret.dst_segment = di;
+	ret.dst_offset = doff;
+	ret.src_segment = si;
+	ret.src_offset = soff;
+	return ret;
+}
+#endif
+
+} // namespace sig
@@ -0,0 +1,143 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef COPY_HPP_INCLUDED
+#define COPY_HPP_INCLUDED
+
+#include <cstddef> // for size_t
+#include <cstdint>
+#include <functional>
+#include <system_error>
+
+#if !defined _WIN32
+#include <sys/uio.h> // for iovec
+#endif
+
+namespace sig {
+
+enum copy_flags : std::uint32_t
+{
+	// fault in the source range with populate() before copying
+	populate_source = 1,
+	// fault in the destination range, for writing, with populate() before
+	// copying
+	populate_destination = 2,
+};
+
+// copies len bytes from src to dst, strictly front-to-back, under the
+// protection of try_signal(). Instead of throwing, it returns the number of
+// bytes copied before the first fault. Every byte before that offset has been
+// copied. If the copy fails, ec is set to the error. The source and
+// destination may not overlap.
+//
+// flags is a combination of copy_flags. If populating a range fails, the copy
+// is still attempted, to find out how much of it succeeds. ec is then set to
+// the (more specific) error from populate().
+std::size_t copy(void* dst, void const* src, std::size_t len, std::error_code& ec
+	, std::uint32_t flags = 0);
+std::size_t copy(void* dst, void const* src, std::size_t len);
+
+// like copy(), but intended for copying into a memory mapped file. Large
+// copies bypass the CPU cache (using non-temporal stores, where available),
+// to avoid evicting hot data with data that's on its way to disk
+std::size_t copy_to_mapped(void* dst, void const* src, std::size_t len
+	, std::error_code& ec, std::uint32_t flags = 0);
+std::size_t copy_to_mapped(void* dst, void const* src, std::size_t len);
+
+// faults in the pages of the range [addr, addr + len), for reading or for
+// writing, ahead of accessing them. On linux 5.14 and later, this is a single
+// madvise() call (MADV_POPULATE_READ or MADV_POPULATE_WRITE), and I/O errors
+// are reported with their errno, rather than as a signal during the access.
+// On other systems, the range is only checked to be mapped, with mincore().
+// On windows, this does nothing.
+std::error_code populate(void const* addr, std::size_t len, bool write);
+
+// returns the CRC32C (Castagnoli) checksum of [buf, buf + len), continuing
+// from crc, the checksum of the bytes before it (0 for the first ones). It
+// uses the SSE4.2 or ARMv8 CRC instructions, where available. The memory is
+// not accessed under try_signal()
+std::uint32_t crc32c(std::uint32_t crc, void const* buf, std::size_t len);
+
+// like copy(), but also computes the CRC32C checksum of the bytes, in the
+// same pass over memory. crc is the checksum to continue from, like for
+// crc32c(), and is updated. If the copy fails, crc is the checksum of the
+// bytes that were copied
+std::size_t copy_crc32c(void* dst, void const* src, std::size_t len
+	, std::uint32_t& crc, std::error_code& ec);
+
+// called with consecutive ranges of the copied bytes (in the destination),
+// while they're still in the CPU cache
+using hash_function = std::function<void(char const* buf, std::size_t len)>;
+
+// like copy(), but also passes the copied bytes to update, e.g. to feed them
+// to an incremental hash function. The copy is done in chunks small enough to
+// stay in the cache, and each chunk is passed to update as soon as it's been
+// copied, all inside a single protection scope. If the copy fails, update has
+// seen exactly the bytes that were copied. update must not fault itself. If it
+// does, its error is returned, with the number of bytes passed to update before
+// the call that faulted.
+std::size_t copy_hash(void* dst, void const* src, std::size_t len
+	, hash_function const& update, std::error_code& ec);
+
+#if !defined _WIN32
+// the outcome of a copyv()
+struct copyv_result
+{
+	// the number of bytes copied. Every byte before the position below has
+	// been copied
+	std::size_t bytes = 0;
+
+	// where the copy stopped, as a segment index and an offset into that
+	// segment, in both lists. If it failed, this is the position of the byte
+	// that faulted (in whichever of the lists it was). Otherwise it's the end
+	// of the shorter list
+	std::size_t dst_segment = 0;
+	std::size_t dst_offset = 0;
+	std::size_t src_segment = 0;
+	std::size_t src_offset = 0;
+
+	// set if the copy failed
+	std::error_code error;
+};
+
+// copies from the segments in src to the segments in dst, like readv() and
+// writev() do for files. The segments are treated as one contiguous range each,
+// and the copy stops at the end of the shorter one. The whole copy runs under a
+// single protection scope, and like copy(), it goes strictly front-to-back and
+// stops at the first fault. Segments may not overlap
+copyv_result copyv(iovec const* dst, std::size_t dst_count
+	, iovec const* src, std::size_t src_count);
+#endif
+
+} // namespace sig
+
+#endif
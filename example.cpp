@@ -1,6 +1,7 @@
 #include <stdexcept>
 #include <vector>
 #include <numeric>
+#include <cstring> // for memcpy
 #include "try_signal.hpp"
 #include <fcntl.h>
 #include <unistd.h>
@@ -0,0 +1,781 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "mapped_file.hpp"
+
+#if !defined _WIN32
+
+#include <algorithm>
+#include <iterator> // for prev
+#include <limits>
+#include <cerrno>
+#include <chrono>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/vfs.h> // for fstatfs
+#include <cstdio> // for fopen
+#endif
+
+#include "copy.hpp"
+
+namespace sig {
+
+namespace {
+
+	// the address space reserved beyond the end of writable files, to allow
+	// them to grow without moving the mapping
+	std::size_t const min_reserve = sizeof(void*) >= 8
+		? std::size_t(1) << 30 : std::size_t(64) << 20;
+
+	// the number of reads in a row that need to continue where the previous
+	// one ended before we consider the access pattern sequential (and the
+	// number that need not to, to consider it random)
+	int const sequential_threshold = 4;
+	int const random_threshold = 8;
+
+	// how far ahead of a sequential reader we ask the kernel to read, and how
+	// far behind it pages are dropped, with drop_behind
+	std::int64_t const readahead_window = 4 * 1024 * 1024;
+
+	// the prefetch thread touches pages this many bytes at a time, and keeps
+	// between min_prefetch_depth and max_prefetch_depth bytes ahead of the
+	// reader. The depth covers what the reader consumes in the time it takes
+	// to page in prefetch_lookahead chunks
+	std::int64_t const prefetch_chunk = 256 * 1024;
+	std::int64_t const min_prefetch_depth = 1024 * 1024;
+	std::int64_t const max_prefetch_depth = 256 * 1024 * 1024;
+	double const prefetch_lookahead = 4;
+
+	std::size_t page_size()
+	{
+		static std::size_t const size = std::size_t(sysconf(_SC_PAGESIZE));
+		return size;
+	}
+
+	std::int64_t page_floor(std::int64_t const v)
+	{
+		return v - v % std::int64_t(page_size());
+	}
+
+	std::int64_t page_ceil(std::int64_t const v)
+	{
+		return page_floor(v + std::int64_t(page_size()) - 1);
+	}
+
+	std::int64_t align_floor(std::int64_t const v, std::size_t const alignment)
+	{
+		return v - v % std::int64_t(alignment);
+	}
+
+	// whether offset + len (for a non-negative offset) is representable as a
+	// file offset
+	bool fits(std::int64_t const offset, std::size_t const len)
+	{
+		return std::uint64_t(len) <= std::uint64_t(
+			std::numeric_limits<std::int64_t>::max() - offset);
+	}
+
+#ifdef __linux__
+	long const hugetlbfs_magic = 0x958458f6;
+#endif
+
+	// the size of transparent huge pages. Other systems don't have them
+	std::size_t read_huge_page_size()
+	{
+#ifdef __linux__
+		std::size_t size = 2 * 1024 * 1024;
+		FILE* f = std::fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+		if (f == nullptr) return size;
+		unsigned long long v;
+		if (std::fscanf(f, "%llu", &v) == 1 && v > 0) size = std::size_t(v);
+		std::fclose(f);
+		return size;
+#else
+		return page_size();
+#endif
+	}
+
+	std::size_t huge_page_size()
+	{
+		static std::size_t const size = read_huge_page_size();
+		return size;
+	}
+
+	// maps the file at an address aligned to alignment, to allow it to be
+	// backed by huge pages. This reserves enough address space to find an
+	// aligned address in, maps the file over it, and releases the rest
+	void* mmap_aligned(std::size_t const len, int const prot, int const fd
+		, std::size_t const alignment)
+	{
+		void* const reserved = mmap(nullptr, len + alignment, PROT_NONE
+			, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (reserved == MAP_FAILED) return MAP_FAILED;
+
+		std::uintptr_t const base = reinterpret_cast<std::uintptr_t>(reserved);
+		std::uintptr_t const start = (base + alignment - 1) & ~std::uintptr_t(alignment - 1);
+		void* const ptr = mmap(reinterpret_cast<void*>(start), len, prot
+			, MAP_SHARED | MAP_FIXED, fd, 0);
+		if (ptr == MAP_FAILED)
+		{
+			int const err = errno;
+			munmap(reserved, len + alignment);
+			errno = err;
+			return MAP_FAILED;
+		}
+		std::size_t const head = std::size_t(start - base);
+		if (head > 0) munmap(reserved, head);
+		if (alignment > head)
+			munmap(reinterpret_cast<char*>(start) + len, alignment - head);
+		return ptr;
+	}
+
+	std::error_code last_error()
+	{
+		return std::error_code(errno, std::system_category());
+	}
+
+	// an exponential moving average
+	double average(double const avg, double const sample)
+	{
+		return avg == 0 ? sample : avg + (sample - avg) / 8;
+	}
+}
+
+mapped_file::mapped_file(char const* path, std::uint32_t const mode)
+	: _fd(open(path, (mode & read_write) ? O_RDWR | O_CREAT | O_CLOEXEC
+		: O_RDONLY | O_CLOEXEC, 0644))
+	, _mode(mode)
+	, _page(page_size())
+	, _size(0)
+	, _next_read(-1)
+	, _streak(0)
+	, _advice(MADV_NORMAL)
+	, _readahead_end(0)
+	, _dropped_end(0)
+	, _has_bad_pages(false)
+	, _fault_threshold(fallback_policy().fault_threshold)
+	, _fault_window(fallback_policy().fault_window.count())
+	, _recovery_calls(fallback_policy().recovery_calls)
+	, _faults(0)
+	, _fault_window_start(0)
+	, _fallback(false)
+	, _fallback_successes(0)
+	, _prefetched_end(0)
+	, _prefetch_depth(readahead_window)
+	, _generation(0)
+	, _prefetch_stop(false)
+{
+	if (_fd < 0) throw std::system_error(last_error());
+
+	struct stat st;
+	if (fstat(_fd, &st) != 0)
+	{
+		std::error_code const ec = last_error();
+		close(_fd);
+		throw std::system_error(ec);
+	}
+	_size.store(st.st_size);
+
+#ifdef __linux__
+	// files on hugetlbfs are always backed by huge pages, with the file
+	// system's block size
+	struct statfs fs;
+	if (fstatfs(_fd, &fs) == 0 && long(fs.f_type) == hugetlbfs_magic)
+	{
+		_hugetlbfs = true;
+		_page = std::size_t(fs.f_bsize);
+	}
+#endif
+
+	std::size_t capacity = std::size_t(page_ceil(st.st_size));
+	if (mode & read_write) capacity = std::max(capacity, min_reserve);
+	if (capacity == 0) return;
+	// hugetlbfs can only map whole huge pages
+	capacity = std::size_t(align_floor(std::int64_t(capacity + _page - 1), _page));
+
+	std::error_code ec;
+	map(capacity, ec);
+	if (ec)
+	{
+		close(_fd);
+		throw std::system_error(ec);
+	}
+
+	if (mode & prefetch)
+	{
+		try
+		{
+			_prefetch_thread = std::thread([this]{ prefetch_loop(); });
+		}
+		catch (...)
+		{
+			munmap(_map, _capacity);
+			close(_fd);
+			throw;
+		}
+	}
+}
+
+mapped_file::~mapped_file()
+{
+	if (_prefetch_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> l(_prefetch_mutex);
+			_prefetch_stop = true;
+		}
+		_prefetch_cond.notify_one();
+		_prefetch_thread.join();
+	}
+	if (_map) munmap(_map, _capacity);
+	close(_fd);
+}
+
+std::size_t mapped_file::read(std::int64_t const offset, void* buf
+	, std::size_t len, std::error_code& ec)
+{
+	len = clamp(offset, len, ec);
+	if (ec || len == 0) return 0;
+
+	if (using_fallback()) return fallback_read(offset, buf, len, ec);
+
+	std::error_code known_error;
+	std::size_t const good = known_good(offset, len, known_error);
+	advise(offset, len);
+	std::size_t const n = sig::copy(buf, _map + offset, good, ec
+		, (_mode & populate) ? std::uint32_t(populate_source) : 0u);
+	// a failed read stops where the bad page starts, even if the page is
+	// huge, and parts of it could be read
+	if (ec) return good_bytes(offset, n, record_last_fault(ec));
+	ec = known_error;
+	return n;
+}
+
+std::size_t mapped_file::write(std::int64_t const offset, void const* buf
+	, std::size_t const len, std::error_code& ec)
+{
+	ec.clear();
+	if ((_mode & read_write) == 0)
+	{
+		ec = std::make_error_code(std::errc::bad_file_descriptor);
+		return 0;
+	}
+	if (offset < 0 || !fits(offset, len))
+	{
+		ec = std::make_error_code(std::errc::invalid_argument);
+		return 0;
+	}
+	if (len == 0) return 0;
+
+	std::int64_t const end = offset + std::int64_t(len);
+	if (end > size())
+	{
+		std::lock_guard<std::mutex> l(_mutex);
+		if (end > _size.load()) set_size(end, ec);
+		if (ec) return 0;
+	}
+
+	if (using_fallback()) return fallback_write(offset, buf, len, ec);
+
+	std::error_code known_error;
+	std::size_t const good = known_good(offset, len, known_error);
+	std::size_t const n = sig::copy_to_mapped(_map + offset, buf, good, ec
+		, (_mode & populate) ? std::uint32_t(populate_destination) : 0u);
+	if (ec) return good_bytes(offset, n, record_last_fault(ec));
+	ec = known_error;
+	return n;
+}
+
+void mapped_file::resize(std::int64_t const size, std::error_code& ec)
+{
+	ec.clear();
+	if ((_mode & read_write) == 0)
+	{
+		ec = std::make_error_code(std::errc::bad_file_descriptor);
+		return;
+	}
+	if (size < 0)
+	{
+		ec = std::make_error_code(std::errc::invalid_argument);
+		return;
+	}
+	std::lock_guard<std::mutex> l(_mutex);
+	set_size(size, ec);
+}
+
+void mapped_file::flush(std::int64_t const offset, std::size_t len
+	, bool const wait, std::error_code& ec)
+{
+	len = clamp(offset, len, ec);
+	if (ec || len == 0) return;
+
+	// msync() operates on whole pages
+	std::int64_t const start = page_floor(offset);
+	std::size_t const n = std::size_t(offset - start) + len;
+#ifdef __linux__
+	if (!wait)
+	{
+		if (sync_file_range(_fd, start, std::int64_t(n), SYNC_FILE_RANGE_WRITE) != 0)
+			ec = last_error();
+		return;
+	}
+#endif
+	if (msync(_map + start, n, wait ? MS_SYNC : MS_ASYNC) != 0)
+		ec = last_error();
+}
+
+void mapped_file::set_size(std::int64_t const size, std::error_code& ec)
+{
+	if (ftruncate(_fd, size) != 0)
+	{
+		ec = last_error();
+		return;
+	}
+
+	if (size > std::int64_t(_capacity))
+	{
+		std::size_t const capacity = std::size_t(align_floor(
+			std::max(page_ceil(size), std::int64_t(_capacity * 2)) + std::int64_t(_page) - 1
+			, _page));
+		map(capacity, ec);
+		if (ec) return;
+	}
+	_size.store(size, std::memory_order_release);
+	clear_bad_pages();
+
+	// the pages we asked the kernel to read ahead, or dropped, may not exist
+	// anymore
+	_readahead_end.store(0, std::memory_order_relaxed);
+	_dropped_end.store(0, std::memory_order_relaxed);
+	_prefetched_end.store(0, std::memory_order_relaxed);
+	_generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+void mapped_file::clear_bad_pages()
+{
+	std::lock_guard<std::mutex> l(_bad_pages_mutex);
+	_bad_pages.clear();
+	_has_bad_pages.store(false, std::memory_order_release);
+}
+
+std::size_t mapped_file::known_good(std::int64_t const offset
+	, std::size_t const len, std::error_code& ec) const
+{
+	if (!_has_bad_pages.load(std::memory_order_acquire)) return len;
+
+	std::lock_guard<std::mutex> l(_bad_pages_mutex);
+	std::int64_t const end = offset + std::int64_t(len);
+	// find the first range that ends after offset
+	auto it = _bad_pages.upper_bound(offset);
+	if (it != _bad_pages.begin() && std::prev(it)->second.end > offset) --it;
+	if (it == _bad_pages.end() || it->first >= end) return len;
+
+	ec = it->second.error;
+	return std::size_t(std::max(it->first, offset) - offset);
+}
+
+std::int64_t mapped_file::record_bad_page(std::int64_t const offset
+	, std::error_code const& ec, std::size_t const extent)
+{
+	std::size_t const page = std::max(_page, extent);
+	std::int64_t start = align_floor(offset, page);
+	std::int64_t end = start + std::int64_t(page);
+	std::int64_t const ret = start;
+
+	std::lock_guard<std::mutex> l(_bad_pages_mutex);
+	auto it = _bad_pages.upper_bound(start);
+	if (it != _bad_pages.begin())
+	{
+		auto const prev = std::prev(it);
+		// this page is already known to be bad
+		if (prev->second.end > start) return ret;
+		if (prev->second.end == start && prev->second.error == ec)
+		{
+			start = prev->first;
+			_bad_pages.erase(prev);
+		}
+	}
+	if (it != _bad_pages.end() && it->first == end && it->second.error == ec)
+	{
+		end = it->second.end;
+		_bad_pages.erase(it);
+	}
+	_bad_pages.emplace(start, bad_range{end, ec});
+	_has_bad_pages.store(true, std::memory_order_release);
+	return ret;
+}
+
+std::int64_t mapped_file::record_last_fault(std::error_code const& ec)
+{
+	fault_info const& fault = sig::detail::last_fault();
+	char const* const addr = static_cast<char const*>(fault.address);
+	if (addr < _map || addr >= _map + _capacity) return -1;
+	std::int64_t const bad = record_bad_page(addr - _map, ec, fault.extent);
+	count_fault();
+	return bad;
+}
+
+std::size_t mapped_file::good_bytes(std::int64_t const offset, std::size_t const n
+	, std::int64_t const bad)
+{
+	if (bad < 0) return n;
+	return std::size_t(std::max(std::int64_t(0), std::min(std::int64_t(n), bad - offset)));
+}
+
+void mapped_file::set_fallback_policy(fallback_policy const& p)
+{
+	_fault_threshold.store(p.fault_threshold, std::memory_order_relaxed);
+	_fault_window.store(p.fault_window.count(), std::memory_order_relaxed);
+	_recovery_calls.store(p.recovery_calls, std::memory_order_relaxed);
+}
+
+void mapped_file::count_fault()
+{
+	int const threshold = _fault_threshold.load(std::memory_order_relaxed);
+	if (threshold <= 0) return;
+
+	// start a new window if the current one has expired. This is a heuristic,
+	// a fault counted concurrently with the reset may be lost
+	std::int64_t const window = _fault_window.load(std::memory_order_relaxed);
+	if (window > 0)
+	{
+		std::int64_t const now = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+		std::int64_t start = _fault_window_start.load(std::memory_order_relaxed);
+		if (now - start >= window && _fault_window_start.compare_exchange_strong(
+			start, now, std::memory_order_relaxed))
+			_faults.store(0, std::memory_order_relaxed);
+	}
+
+	if (_faults.fetch_add(1, std::memory_order_relaxed) + 1 < threshold) return;
+
+	_fallback_successes.store(0, std::memory_order_relaxed);
+	_fallback.store(true, std::memory_order_relaxed);
+}
+
+void mapped_file::count_fallback(std::int64_t const offset
+	, std::error_code const& ec)
+{
+	if (ec)
+	{
+		// failing again on a page we already know is bad doesn't say anything
+		// new about the health of the file
+		std::error_code known_error;
+		if (known_good(offset, 1, known_error) == 0) return;
+		record_bad_page(offset, ec);
+		_fallback_successes.store(0, std::memory_order_relaxed);
+		return;
+	}
+	if (_fallback_successes.fetch_add(1, std::memory_order_relaxed) + 1
+		< _recovery_calls.load(std::memory_order_relaxed))
+		return;
+
+	// the file seems healthy again. Give the mapping another chance. The pages
+	// known to be bad are still avoided
+	_faults.store(0, std::memory_order_relaxed);
+	_fallback.store(false, std::memory_order_relaxed);
+}
+
+std::size_t mapped_file::fallback_read(std::int64_t const offset, void* buf
+	, std::size_t const len, std::error_code& ec)
+{
+	std::size_t n = 0;
+	while (n < len)
+	{
+		ssize_t const ret = ::pread(_fd, static_cast<char*>(buf) + n, len - n
+			, offset + std::int64_t(n));
+		if (ret < 0)
+		{
+			if (errno == EINTR) continue;
+			ec = last_error();
+			break;
+		}
+		// the file has been truncated behind our back. The mapping would
+		// raise SIGBUS for these bytes, report the same error. It's not a
+		// sign the file has recovered
+		if (ret == 0)
+		{
+			ec = sig::errors::make_error_code(sig::errors::bus);
+			break;
+		}
+		n += std::size_t(ret);
+	}
+	count_fallback(offset + std::int64_t(n), ec);
+	return n;
+}
+
+std::size_t mapped_file::fallback_write(std::int64_t const offset
+	, void const* buf, std::size_t const len, std::error_code& ec)
+{
+	std::size_t n = 0;
+	while (n < len)
+	{
+		ssize_t const ret = ::pwrite(_fd, static_cast<char const*>(buf) + n
+			, len - n, offset + std::int64_t(n));
+		if (ret < 0)
+		{
+			if (errno == EINTR) continue;
+			ec = last_error();
+			break;
+		}
+		if (ret == 0) break;
+		n += std::size_t(ret);
+	}
+	count_fallback(offset + std::int64_t(n), ec);
+	return n;
+}
+
+void mapped_file::map(std::size_t const capacity, std::error_code& ec)
+{
+	int const prot = (_mode & read_write) ? PROT_READ | PROT_WRITE : PROT_READ;
+	// transparent huge pages can only back the parts of the mapping that are
+	// aligned to the huge page size. mremap() doesn't preserve that
+	bool const align = (_mode & huge_pages) && !_hugetlbfs;
+	void* ptr;
+#ifdef MREMAP_MAYMOVE
+	if (_map != nullptr && !align)
+	{
+		ptr = mremap(_map, _capacity, capacity, MREMAP_MAYMOVE);
+	}
+	else
+#endif
+	{
+		ptr = align ? mmap_aligned(capacity, prot, _fd, huge_page_size())
+			: mmap(nullptr, capacity, prot, MAP_SHARED, _fd, 0);
+		// the old mapping is only removed once the new one is in place, so
+		// that if mapping fails, the file is still mapped
+		if (ptr != MAP_FAILED && _map != nullptr) munmap(_map, _capacity);
+	}
+
+	if (ptr == MAP_FAILED)
+	{
+		ec = last_error();
+		return;
+	}
+	_map = static_cast<char*>(ptr);
+	_capacity = capacity;
+	_advice.store(MADV_NORMAL, std::memory_order_relaxed);
+
+#ifdef MADV_HUGEPAGE
+	// this is only a hint. Whether the kernel actually backs the mapping with
+	// transparent huge pages depends on the file system and the system
+	// settings. Either way, the granularity of faults stays the normal page
+	// size, since the kernel splits huge pages that straddle the end of the
+	// file when it's truncated
+	if (align) madvise(_map, _capacity, MADV_HUGEPAGE);
+#endif
+}
+
+std::size_t mapped_file::clamp(std::int64_t const offset, std::size_t const len
+	, std::error_code& ec) const
+{
+	ec.clear();
+	if (offset < 0 || !fits(offset, len))
+	{
+		ec = std::make_error_code(std::errc::invalid_argument);
+		return 0;
+	}
+	std::int64_t const size = this->size();
+	if (offset >= size) return 0;
+	return std::size_t(std::min(std::int64_t(len), size - offset));
+}
+
+void mapped_file::advise(std::int64_t const offset, std::size_t const len)
+{
+	std::int64_t const end = offset + std::int64_t(len);
+	bool const sequential
+		= _next_read.exchange(end, std::memory_order_relaxed) == offset;
+
+	// this is a heuristic, it's not a problem if concurrent readers race here
+	int streak = _streak.load(std::memory_order_relaxed);
+	streak = sequential ? std::max(streak, 0) + 1 : std::min(streak, 0) - 1;
+	_streak.store(streak, std::memory_order_relaxed);
+
+	int const advice = streak >= sequential_threshold ? MADV_SEQUENTIAL
+		: streak <= -random_threshold ? MADV_RANDOM
+		: _advice.load(std::memory_order_relaxed);
+
+	if (_advice.exchange(advice, std::memory_order_relaxed) != advice)
+		madvise(_map, _capacity, advice);
+
+	if (advice != MADV_SEQUENTIAL) return;
+
+	if ((_mode & prefetch) && prefetch_behind())
+	{
+		// taking the mutex makes sure the prefetch thread is either waiting,
+		// or hasn't checked prefetch_behind() yet
+		{ std::lock_guard<std::mutex> l(_prefetch_mutex); }
+		_prefetch_cond.notify_one();
+	}
+
+	// keep a window of pages being read ahead of the reader. Ask for more once
+	// the reader is half way through it
+	std::int64_t ahead = _readahead_end.load(std::memory_order_relaxed);
+	if (end + readahead_window / 2 > ahead)
+	{
+		std::int64_t const from = std::max(ahead, page_floor(end));
+		std::int64_t const to = std::min(page_ceil(size()), page_ceil(end + readahead_window));
+		if (to > from && _readahead_end.compare_exchange_strong(ahead, to
+			, std::memory_order_relaxed))
+		{
+			madvise(_map + from, std::size_t(to - from), MADV_WILLNEED);
+		}
+	}
+
+	if (_mode & drop_behind)
+	{
+		// don't split huge pages
+		std::int64_t const drop_to = align_floor(offset, _page);
+		std::int64_t dropped = _dropped_end.load(std::memory_order_relaxed);
+		if (drop_to - dropped >= readahead_window
+			&& _dropped_end.compare_exchange_strong(dropped, drop_to
+				, std::memory_order_relaxed))
+		{
+			madvise(_map + dropped, std::size_t(drop_to - dropped), MADV_DONTNEED);
+		}
+	}
+}
+
+bool mapped_file::prefetch_behind() const
+{
+	if (_advice.load(std::memory_order_relaxed) != MADV_SEQUENTIAL) return false;
+	std::int64_t const prefetched = _prefetched_end.load(std::memory_order_relaxed);
+	return prefetched < page_ceil(size())
+		&& _next_read.load(std::memory_order_relaxed)
+			+ _prefetch_depth.load(std::memory_order_relaxed) / 2 > prefetched;
+}
+
+void mapped_file::prefetch_loop()
+{
+	using clock_type = std::chrono::steady_clock;
+
+	// moving averages of the rate the reader consumes the file at (in bytes
+	// per second), and of the time it takes to touch a chunk (in seconds)
+	double rate = 0;
+	double latency = 0;
+	std::int64_t last_pos = -1;
+	clock_type::time_point last_time = clock_type::now();
+
+	std::unique_lock<std::mutex> l(_prefetch_mutex);
+	for (;;)
+	{
+		_prefetch_cond.wait(l, [this]{ return _prefetch_stop || prefetch_behind(); });
+		if (_prefetch_stop) return;
+		l.unlock();
+
+		std::int64_t const pos = _next_read.load(std::memory_order_relaxed);
+		clock_type::time_point const now = clock_type::now();
+		double const elapsed = std::chrono::duration<double>(now - last_time).count();
+		if (last_pos >= 0 && pos > last_pos && elapsed > 0)
+			rate = average(rate, double(pos - last_pos) / elapsed);
+		last_pos = pos;
+		last_time = now;
+
+		// read the generation first, so that if the file is resized after
+		// this, touch() notices
+		std::uint64_t const generation = _generation.load(std::memory_order_relaxed);
+		std::int64_t from = _prefetched_end.load(std::memory_order_relaxed);
+		std::int64_t depth = _prefetch_depth.load(std::memory_order_relaxed);
+		if (from > 0 && pos >= from)
+		{
+			// the reader caught up with us. We're not far enough ahead
+			depth *= 2;
+		}
+		else
+		{
+			// grow to the estimate right away, but shrink towards it slowly
+			std::int64_t const estimate = std::int64_t(rate * latency * prefetch_lookahead);
+			depth = std::max(estimate, depth - depth / 8);
+		}
+		depth = std::min(std::max(depth, min_prefetch_depth), max_prefetch_depth);
+		_prefetch_depth.store(depth, std::memory_order_relaxed);
+
+		from = std::max(from, page_floor(pos));
+		std::int64_t const to = std::min(page_ceil(size()), page_ceil(pos + depth));
+		while (from < to && !_prefetch_stop)
+		{
+			clock_type::time_point const start = clock_type::now();
+			from = touch(from, std::min(to, from + prefetch_chunk), generation);
+			// the file was resized. Start over from where the reader is
+			if (from < 0) break;
+			latency = average(latency
+				, std::chrono::duration<double>(clock_type::now() - start).count());
+		}
+		l.lock();
+	}
+}
+
+std::int64_t mapped_file::touch(std::int64_t from, std::int64_t const to
+	, std::uint64_t const generation)
+{
+	// touching one byte faults in the whole (possibly huge) page
+	std::int64_t const page = std::int64_t(_page);
+
+	// don't fault on pages we already know are bad. If the first one is, skip
+	// it
+	std::error_code ec;
+	std::int64_t const end = from + std::int64_t(known_good(from
+		, std::size_t(to - from), ec));
+	if (end == from)
+	{
+		std::lock_guard<std::mutex> l(_mutex);
+		if (_generation.load(std::memory_order_relaxed) != generation) return -1;
+		_prefetched_end.store(from + page, std::memory_order_relaxed);
+		return from + page;
+	}
+
+	while (from < end)
+	{
+		// the mapping must not move while we touch it. The lock is taken for
+		// one page at a time, so that resizing the file doesn't have to wait
+		// for a whole chunk to be read from disk
+		std::lock_guard<std::mutex> l(_mutex);
+		if (_generation.load(std::memory_order_relaxed) != generation) return -1;
+		char const volatile* const ptr = _map + from;
+		ec = sig::try_signal_noexcept([&]{ static_cast<void>(*ptr); });
+		// unlike the reader's faults, these don't count towards falling back
+		// to pread(), since they never reach the reader
+		from = ec ? record_bad_page(from, ec) + page : std::min(end, from + page);
+		_prefetched_end.store(from, std::memory_order_relaxed);
+		if (ec) break;
+	}
+	return from;
+}
+
+} // namespace sig
+
+#endif // _WIN32
@@ -0,0 +1,335 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef MAPPED_FILE_HPP_INCLUDED
+#define MAPPED_FILE_HPP_INCLUDED
+
+#if !defined _WIN32
+
+#include <cstdint>
+#include <cstddef> // for size_t
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <map>
+#include <chrono>
+#include <system_error>
+
+#include "try_signal.hpp"
+
+namespace sig {
+
+// a file mapped into memory. Accesses through read(), write() and view() are
+// protected by try_signal(), I/O errors are reported as error codes.
+//
+// Pages that have failed are remembered. Later accesses to them fail
+// immediately, with the same error, without touching the mapping. This index
+// is cleared when the file is resized, or by calling clear_bad_pages().
+//
+// When a file keeps faulting (e.g. because the disk is failing), read() and
+// write() switch from the mapping to pread() and pwrite(), which report errors
+// with their errno and don't take a signal per bad page. Once those succeed
+// for a while, they switch back to the mapping, still avoiding the pages known
+// to be bad. See fallback_policy.
+//
+// read(), write() and view() may be called concurrently. Writes past the end
+// grow the file. The mapping reserves address space beyond the end of the
+// file, to allow it to grow in place. Growing it past capacity() moves the
+// mapping, which must not happen concurrently with other accesses.
+//
+// With the prefetch mode, a thread touches the pages ahead of a sequential
+// reader, under try_signal(), so that the reader doesn't have to wait for them
+// to be read from disk. Pages that fail end up in the index of bad pages, and
+// the reader gets the error without taking a fault (these faults don't count
+// towards the fallback). How far ahead it touches pages adapts to how fast the
+// reader consumes them, and how long they take to page in. The thread holds
+// the lock that resize() and growing write() take while it pages in a single
+// page (a huge page, on hugetlbfs), so those may wait for one page to be read
+// from disk.
+//
+// Files on hugetlbfs are backed by huge pages. One fault covers a whole huge
+// page, and bad pages are recorded, and reads and writes that fail stop, at
+// huge page boundaries. With the huge_pages mode, other files are mapped at a
+// huge page aligned address, and with MADV_HUGEPAGE, to let the kernel back
+// them with transparent huge pages. Those still fail one normal page at a
+// time. See granularity().
+struct mapped_file
+{
+	enum open_mode : std::uint32_t
+	{
+		read_only = 0,
+		// open the file for writing, creating it if it doesn't exist
+		read_write = 1,
+		// discard pages behind a sequential reader from the mapping. They are
+		// still kept in the page cache
+		drop_behind = 2,
+		// fault in the pages of each read and write with a single system call
+		// before accessing them, see sig::populate()
+		populate = 4,
+		// touch the pages ahead of a sequential reader on a separate thread
+		prefetch = 8,
+		// map the file to be backed by transparent huge pages, where supported
+		huge_pages = 16,
+	};
+
+	struct fallback_policy
+	{
+		// the number of faults within fault_window after which read() and
+		// write() stop using the mapping, and use pread() and pwrite() instead.
+		// 0 disables the fallback
+		int fault_threshold = 16;
+
+		// faults older than this are forgotten, so that a long-running process
+		// doesn't eventually fall back because of a few isolated faults. 0
+		// means faults are never forgotten
+		std::chrono::milliseconds fault_window = std::chrono::seconds(10);
+
+		// the number of successful calls to pread() or pwrite() in a row after
+		// which read() and write() go back to using the mapping. Calls that
+		// fail within a range already known to be bad don't break the streak
+		int recovery_calls = 1024;
+	};
+
+	// opens and maps the file at path. Throws std::system_error on failure
+	mapped_file(char const* path, std::uint32_t mode);
+	~mapped_file();
+	mapped_file(mapped_file const&) = delete;
+	mapped_file& operator=(mapped_file const&) = delete;
+
+	// copies up to len bytes at offset into buf. Reads past the end of the
+	// file are truncated. Returns the number of bytes read before the first
+	// fault. ec is set if the read failed
+	std::size_t read(std::int64_t offset, void* buf, std::size_t len
+		, std::error_code& ec);
+
+	// copies len bytes from buf into the file at offset, growing it if
+	// necessary. Returns the number of bytes written before the first fault.
+	// ec is set if the write failed
+	std::size_t write(std::int64_t offset, void const* buf, std::size_t len
+		, std::error_code& ec);
+
+	// calls f(ptr, n) with a pointer directly into the mapping, for the range
+	// [offset, offset + n). n is len, or less if the range extends past the
+	// end of the file. f is called under the protection of try_signal() and
+	// must not retain the pointer. If the range is empty, f is not called.
+	template <typename Fun>
+	std::error_code view(std::int64_t offset, std::size_t len, Fun&& f)
+	{
+		std::error_code ec;
+		len = clamp(offset, len, ec);
+		if (ec || len == 0) return ec;
+		if (known_good(offset, len, ec) < len) return ec;
+		char const* ptr = _map + offset;
+		advise(offset, len);
+		ec = sig::try_signal_noexcept([&]{ f(ptr, len); });
+		if (ec) record_last_fault(ec);
+		return ec;
+	}
+
+	// changes the size of the file. This clears the index of bad pages. On
+	// hugetlbfs, the size must be a multiple of the huge page size
+	void resize(std::int64_t size, std::error_code& ec);
+
+	// writes the dirty pages in the range [offset, offset + len) back to
+	// disk. If wait is false, this only starts the writeback and returns
+	// without waiting for it to complete (on linux, with sync_file_range()).
+	// If wait is true, it returns once the data is on disk
+	void flush(std::int64_t offset, std::size_t len, bool wait
+		, std::error_code& ec);
+
+	// forget about all pages that have failed, and try accessing them again
+	void clear_bad_pages();
+
+	void set_fallback_policy(fallback_policy const& p);
+
+	// returns true if read() and write() currently use pread() and pwrite()
+	// instead of the mapping
+	bool using_fallback() const
+	{ return _fallback.load(std::memory_order_relaxed); }
+
+	// with the prefetch mode, the offset up to which the prefetch thread has
+	// touched the pages ahead of the reader, and how far ahead of the reader
+	// it currently aims to be
+	std::int64_t prefetch_end() const
+	{ return _prefetched_end.load(std::memory_order_relaxed); }
+	std::int64_t prefetch_depth() const
+	{ return _prefetch_depth.load(std::memory_order_relaxed); }
+
+	// the size of the pages faults are taken to cover. This is the huge page
+	// size for files on hugetlbfs, and the normal page size otherwise, even
+	// when transparent huge pages back the mapping (the kernel splits those
+	// when the file is truncated under them)
+	std::size_t granularity() const { return _page; }
+
+	std::int64_t size() const { return _size.load(std::memory_order_acquire); }
+	std::int64_t capacity() const { return std::int64_t(_capacity); }
+	int fd() const { return _fd; }
+
+private:
+
+	// returns len, or fewer bytes if the range extends past the end of the
+	// file. Sets ec if offset is invalid, or if offset + len overflows
+	std::size_t clamp(std::int64_t offset, std::size_t len, std::error_code& ec) const;
+
+	// returns the number of bytes at offset that are not known to fail,
+	// up to len. If fewer than len, ec is set to the error of the first bad
+	// page
+	std::size_t known_good(std::int64_t offset, std::size_t len
+		, std::error_code& ec) const;
+
+	// records the page containing offset as bad, failing with ec. The page is
+	// granularity() bytes, or extent, if that's larger. Returns the offset of
+	// the start of the page
+	std::int64_t record_bad_page(std::int64_t offset, std::error_code const& ec
+		, std::size_t extent = 0);
+
+	// records the page of the last fault caught by this thread as bad, if it
+	// was in the mapping (and not, say, in the buffer we were copying into).
+	// Returns the offset of the start of the page, or -1 if it was not in the
+	// mapping
+	std::int64_t record_last_fault(std::error_code const& ec);
+
+	// the number of bytes of a read or write at offset that failed after n
+	// bytes, that lie before the bad page starting at bad
+	static std::size_t good_bytes(std::int64_t offset, std::size_t n
+		, std::int64_t bad);
+
+	// read() and write() in terms of pread() and pwrite()
+	std::size_t fallback_read(std::int64_t offset, void* buf, std::size_t len
+		, std::error_code& ec);
+	std::size_t fallback_write(std::int64_t offset, void const* buf
+		, std::size_t len, std::error_code& ec);
+
+	// counts a fault towards the fallback threshold, or a successful
+	// pread()/pwrite() towards switching back to the mapping. A failed one
+	// at offset breaks the streak, unless offset is in a known-bad range, in
+	// which case it's recorded as bad
+	void count_fault();
+	void count_fallback(std::int64_t offset, std::error_code const& ec);
+
+	// issues madvise() hints based on the pattern of reads
+	void advise(std::int64_t offset, std::size_t len);
+
+	// returns true if the reader has got within half the prefetch depth of
+	// the pages touched by the prefetch thread
+	bool prefetch_behind() const;
+
+	// the prefetch thread
+	void prefetch_loop();
+
+	// touches the pages in [from, to), and returns the offset it got to. If a
+	// page fails, it's recorded as bad, and this returns the offset of the
+	// page after it. Returns -1 if the file has been resized since generation
+	// was read from _generation. Progress is published to _prefetched_end
+	// under _mutex, so it never overwrites the reset done by set_size()
+	std::int64_t touch(std::int64_t from, std::int64_t to
+		, std::uint64_t generation);
+
+	// maps (or remaps) the file with the specified capacity
+	void map(std::size_t capacity, std::error_code& ec);
+
+	// changes the size of the file. Must be called with _mutex held
+	void set_size(std::int64_t size, std::error_code& ec);
+
+	int _fd;
+	std::uint32_t _mode;
+	// the granularity() of the mapping, and whether the file is on hugetlbfs
+	std::size_t _page;
+	bool _hugetlbfs = false;
+	char* _map = nullptr;
+	std::size_t _capacity = 0;
+	std::atomic<std::int64_t> _size;
+
+	// held while changing the size of the file or the mapping
+	std::mutex _mutex;
+
+	// the end of the last read, and the number of reads in a row that picked
+	// up where the previous one ended (or, if negative, didn't)
+	std::atomic<std::int64_t> _next_read;
+	std::atomic<int> _streak;
+	// the last madvise() advice applied to the whole mapping, and how far
+	// ahead of the reader we have asked the kernel to read
+	std::atomic<int> _advice;
+	std::atomic<std::int64_t> _readahead_end;
+	// the end of the range behind the reader we've already dropped, with
+	// drop_behind
+	std::atomic<std::int64_t> _dropped_end;
+
+	struct bad_range
+	{
+		std::int64_t end;
+		std::error_code error;
+	};
+
+	// the page ranges that have failed, indexed by their start offset.
+	// Adjacent ranges that failed with the same error are merged.
+	// _has_bad_pages is set when it's not empty, to keep accesses from having
+	// to take the mutex in the common case
+	mutable std::mutex _bad_pages_mutex;
+	std::map<std::int64_t, bad_range> _bad_pages;
+	std::atomic<bool> _has_bad_pages;
+
+	// the current fallback_policy. The window is in milliseconds
+	std::atomic<int> _fault_threshold;
+	std::atomic<std::int64_t> _fault_window;
+	std::atomic<int> _recovery_calls;
+	// the number of faults in the current window (and when it started, in
+	// milliseconds of the steady clock), whether read() and write() currently
+	// use pread() and pwrite(), and how many of those have succeeded in a row
+	std::atomic<int> _faults;
+	std::atomic<std::int64_t> _fault_window_start;
+	std::atomic<bool> _fallback;
+	std::atomic<int> _fallback_successes;
+
+	// the end of the pages touched by the prefetch thread, and how far ahead
+	// of the reader it touches them
+	std::atomic<std::int64_t> _prefetched_end;
+	std::atomic<std::int64_t> _prefetch_depth;
+
+	// incremented (under _mutex) every time the file is resized. The prefetch
+	// thread abandons what it's doing when it changes
+	std::atomic<std::uint64_t> _generation;
+
+	// the reader wakes up the prefetch thread through _prefetch_cond when it
+	// gets close to _prefetched_end
+	std::mutex _prefetch_mutex;
+	std::condition_variable _prefetch_cond;
+	std::atomic<bool> _prefetch_stop;
+	std::thread _prefetch_thread;
+};
+
+} // namespace sig
+
+#endif // _WIN32
+
+#endif
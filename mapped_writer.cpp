@@ -0,0 +1,151 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "mapped_writer.hpp"
+
+#if !defined _WIN32
+
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+
+namespace sig {
+
+mapped_writer::mapped_writer(char const* path)
+	: mapped_writer(path, options())
+{}
+
+mapped_writer::mapped_writer(char const* path, options const& opts)
+	: _file(path, mapped_file::read_write)
+	, _options(opts)
+	, _end(_file.size())
+	, _reserved(_end)
+	, _flushed(_end)
+	, _synced(_end)
+	, _last_flush(std::chrono::steady_clock::now())
+{}
+
+mapped_writer::~mapped_writer()
+{
+	// give back the space reserved ahead
+	std::error_code ec;
+	if (_reserved > _end) _file.resize(_end, ec);
+}
+
+std::size_t mapped_writer::append(void const* buf, std::size_t const len
+	, std::error_code& ec)
+{
+	ec.clear();
+	if (len == 0) return 0;
+
+	reserve(_end + std::int64_t(len), ec);
+	if (ec) return 0;
+
+	std::size_t const n = _file.write(_end, buf, len, ec);
+	_end += std::int64_t(n);
+	if (ec) return n;
+
+	maybe_flush(ec);
+	return n;
+}
+
+void mapped_writer::flush(std::error_code& ec)
+{
+	ec.clear();
+	_last_flush = std::chrono::steady_clock::now();
+	if (_end == _flushed) return;
+	_file.flush(_flushed, std::size_t(_end - _flushed), false, ec);
+	if (!ec) _flushed = _end;
+}
+
+void mapped_writer::sync(std::error_code& ec)
+{
+	ec.clear();
+	if (_end == _synced) return;
+	_file.flush(_synced, std::size_t(_end - _synced), true, ec);
+	if (ec) return;
+	_synced = _end;
+	_flushed = std::max(_flushed, _end);
+}
+
+void mapped_writer::reserve(std::int64_t const end, std::error_code& ec)
+{
+	if (end <= _reserved) return;
+
+	std::int64_t const chunk = std::max(_options.reserve_chunk, std::int64_t(1));
+	std::int64_t const target = (end + chunk - 1) / chunk * chunk;
+
+#ifdef __linux__
+	if (!_reserve_unsupported)
+	{
+		// allocate the blocks without changing the size of the file. It's
+		// grown separately below, which may also move the mapping
+		int ret = fallocate(_file.fd(), FALLOC_FL_KEEP_SIZE, _reserved, target - _reserved);
+		// if a whole chunk doesn't fit, settle for what we need right now
+		if (ret != 0 && errno == ENOSPC && end < target)
+			ret = fallocate(_file.fd(), FALLOC_FL_KEEP_SIZE, _reserved, end - _reserved);
+		if (ret != 0)
+		{
+			if (errno != EOPNOTSUPP)
+			{
+				ec = std::error_code(errno, std::system_category());
+				return;
+			}
+			_reserve_unsupported = true;
+		}
+	}
+#else
+	// there's no portable way to reserve disk space without changing the
+	// size of the file. Faults from running out of space are still caught
+	_reserve_unsupported = true;
+#endif
+
+	// if the file system can't reserve space, growing the file one chunk at a
+	// time would create a large sparse file that we can't promise to fill
+	std::int64_t const size = _reserve_unsupported ? end : target;
+	_file.resize(size, ec);
+	if (!ec) _reserved = size;
+}
+
+void mapped_writer::maybe_flush(std::error_code& ec)
+{
+	bool const enough_bytes = _options.flush_bytes > 0
+		&& _end - _flushed >= _options.flush_bytes;
+	bool const enough_time = _options.flush_interval.count() > 0
+		&& std::chrono::steady_clock::now() - _last_flush >= _options.flush_interval;
+	if (enough_bytes || enough_time) flush(ec);
+}
+
+} // namespace sig
+
+#endif // _WIN32
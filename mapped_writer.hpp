@@ -0,0 +1,140 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef MAPPED_WRITER_HPP_INCLUDED
+#define MAPPED_WRITER_HPP_INCLUDED
+
+#if !defined _WIN32
+
+#include <cstdint>
+#include <cstddef> // for size_t
+#include <chrono>
+#include <system_error>
+
+#include "mapped_file.hpp"
+
+namespace sig {
+
+// appends to a file through a memory mapping. Disk space is reserved ahead of
+// the writes, in large chunks, so running out of space is reported as an
+// error code (ENOSPC) before anything is written, rather than as SIGBUS when
+// the page is written back. The file is grown along with the reservation, so
+// appends don't need a system call, and the mapping is grown in place where
+// possible (with mremap() on linux). Writes are protected by try_signal(), for
+// any faults that happen anyway.
+//
+// Dirty pages are written back in batches: once enough bytes have been
+// appended, or enough time has passed, since the last batch.
+//
+// While the writer is open, the file is larger than what has been appended,
+// by the space reserved ahead. The destructor truncates it to the appended
+// size. If the process dies before that, the file is left with zeros at the
+// end.
+//
+// A mapped_writer may only be used by one thread at a time.
+struct mapped_writer
+{
+	struct options
+	{
+		// the amount of disk space reserved at a time
+		std::int64_t reserve_chunk = 64 * 1024 * 1024;
+
+		// start writing back dirty pages when this many bytes have been
+		// appended since the last time, or when flush_interval has passed.
+		// 0 disables each trigger
+		std::int64_t flush_bytes = 8 * 1024 * 1024;
+		std::chrono::milliseconds flush_interval{1000};
+	};
+
+	// opens (or creates) the file at path, for appending to the end of it.
+	// Throws std::system_error on failure
+	explicit mapped_writer(char const* path);
+	mapped_writer(char const* path, options const& opts);
+	~mapped_writer();
+	mapped_writer(mapped_writer const&) = delete;
+	mapped_writer& operator=(mapped_writer const&) = delete;
+
+	// appends len bytes from buf to the file. Returns the number of bytes
+	// appended. If not all of them were, ec is set. If disk space for them
+	// can't be reserved, nothing is appended
+	std::size_t append(void const* buf, std::size_t len, std::error_code& ec);
+
+	// starts writing back all bytes appended so far, without waiting for it
+	void flush(std::error_code& ec);
+
+	// waits for all bytes appended so far to be written to disk
+	void sync(std::error_code& ec);
+
+	// the number of bytes in the file, not counting the reservation
+	std::int64_t size() const { return _end; }
+
+	// the end of the disk space reserved for the file
+	std::int64_t reserved() const { return _reserved; }
+
+	// the underlying file. Reads from it are fine, but writes to it, or
+	// resizing it, confuse the writer
+	mapped_file& file() { return _file; }
+
+private:
+
+	// makes sure there is disk space reserved (and the file is large enough)
+	// for the bytes up to end
+	void reserve(std::int64_t end, std::error_code& ec);
+
+	// starts writing back the bytes appended since the last flush, if it's
+	// time to
+	void maybe_flush(std::error_code& ec);
+
+	mapped_file _file;
+	options _options;
+
+	// the number of bytes appended (including what was in the file when it
+	// was opened), and the end of the reserved space
+	std::int64_t _end;
+	std::int64_t _reserved;
+
+	// set if the file system doesn't support reserving space. Appends then
+	// just grow the file
+	bool _reserve_unsupported = false;
+
+	// the bytes before _flushed have been written back, or are being written
+	// back. The bytes before _synced are on disk
+	std::int64_t _flushed;
+	std::int64_t _synced;
+	std::chrono::steady_clock::time_point _last_flush;
+};
+
+} // namespace sig
+
+#endif // _WIN32
+
+#endif
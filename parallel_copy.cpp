@@ -0,0 +1,195 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility> // for move
+
+#include "parallel_copy.hpp"
+#include "copy.hpp"
+#include "try_signal.hpp"
+
+namespace sig {
+
+namespace {
+
+// the unit of work handed to threads. It's a multiple of any page size we
+// expect, and large enough for the cost of claiming it to be negligible
+std::size_t const chunk_size = 1024 * 1024;
+
+// the state shared by the threads participating in one parallel_copy(). It's
+// reference counted, since threads that start late (after all chunks have been
+// claimed) may still look at it after parallel_copy() has returned
+struct copy_job
+{
+	copy_job(char* d, char const* s, std::size_t const l, std::uint32_t const f)
+		: dst(d), src(s), len(l), flags(f)
+		, skew(reinterpret_cast<std::uintptr_t>(s) % chunk_size)
+		, num_chunks((l + skew + chunk_size - 1) / chunk_size)
+		, first_fault(l)
+	{}
+
+	char* const dst;
+	char const* const src;
+	std::size_t const len;
+	std::uint32_t const flags;
+
+	// the offset of src from the chunk boundary before it. Chunk boundaries
+	// are aligned in the source, which is what's expected to be mapped
+	std::size_t const skew;
+	std::size_t const num_chunks;
+
+	// the next chunk to claim
+	std::atomic<std::size_t> next_chunk{0};
+
+	std::mutex mutex;
+	std::condition_variable done_cond;
+	// protected by mutex
+	std::size_t chunks_done = 0;
+	std::size_t first_fault;
+	std::error_code error;
+
+	// claims and copies chunks until there are no more
+	void work();
+};
+
+void copy_job::work()
+{
+	for (;;)
+	{
+		std::size_t const chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+		if (chunk >= num_chunks) return;
+
+		std::size_t const begin = chunk == 0 ? 0 : chunk * chunk_size - skew;
+		std::size_t const end = std::min(len, (chunk + 1) * chunk_size - skew);
+
+		// there's no point in copying past a fault we already know about
+		std::size_t copied = end - begin;
+		std::error_code ec;
+		bool skip;
+		{
+			std::lock_guard<std::mutex> l(mutex);
+			skip = begin >= first_fault;
+		}
+		if (!skip)
+			copied = sig::copy(dst + begin, src + begin, end - begin, ec, flags);
+
+		std::lock_guard<std::mutex> l(mutex);
+		if (ec && begin + copied < first_fault)
+		{
+			first_fault = begin + copied;
+			error = ec;
+		}
+		if (++chunks_done == num_chunks) done_cond.notify_all();
+	}
+}
+
+} // anonymous namespace
+
+worker_pool::worker_pool(int num_threads)
+{
+	if (num_threads <= 0)
+		num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+	_threads.reserve(std::size_t(num_threads));
+	for (int i = 0; i < num_threads; ++i)
+		_threads.emplace_back([this]{ run(); });
+}
+
+worker_pool::~worker_pool()
+{
+	{
+		std::lock_guard<std::mutex> l(_mutex);
+		_stop = true;
+	}
+	_cond.notify_all();
+	for (auto& t : _threads) t.join();
+}
+
+void worker_pool::post(std::function<void()> f)
+{
+	{
+		std::lock_guard<std::mutex> l(_mutex);
+		_queue.push_back(std::move(f));
+	}
+	_cond.notify_one();
+}
+
+void worker_pool::run()
+{
+#if !defined _WIN32
+	// faults caused by running out of stack should be reported like any
+	// other
+	use_alt_stack();
+#endif
+	std::unique_lock<std::mutex> l(_mutex);
+	for (;;)
+	{
+		_cond.wait(l, [this]{ return _stop || !_queue.empty(); });
+		if (_queue.empty()) return;
+		std::function<void()> f = std::move(_queue.front());
+		_queue.pop_front();
+		l.unlock();
+		f();
+		l.lock();
+	}
+}
+
+std::size_t parallel_copy(void* dst, void const* src, std::size_t const len
+	, worker_pool& pool, std::error_code& ec, std::uint32_t const flags)
+{
+	auto const job = std::make_shared<copy_job>(static_cast<char*>(dst)
+		, static_cast<char const*>(src), len, flags);
+
+	if (job->num_chunks < 2)
+		return copy(dst, src, len, ec, flags);
+
+	std::size_t const helpers = std::min(std::size_t(pool.size()), job->num_chunks - 1);
+	for (std::size_t i = 0; i < helpers; ++i)
+		pool.post([job]{ job->work(); });
+
+	job->work();
+
+	std::unique_lock<std::mutex> l(job->mutex);
+	job->done_cond.wait(l, [&]{ return job->chunks_done == job->num_chunks; });
+	ec = job->error;
+	return job->first_fault;
+}
+
+std::size_t parallel_copy(void* dst, void const* src, std::size_t const len
+	, worker_pool& pool)
+{
+	std::error_code ec;
+	return parallel_copy(dst, src, len, pool, ec);
+}
+
+} // namespace sig
@@ -0,0 +1,95 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef PARALLEL_COPY_HPP_INCLUDED
+#define PARALLEL_COPY_HPP_INCLUDED
+
+#include <cstddef> // for size_t
+#include <cstdint>
+#include <system_error>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+namespace sig {
+
+// a fixed set of threads running posted function objects, in the order they
+// were posted. Each thread has an alternate signal stack (see
+// use_alt_stack()). The destructor waits for all posted functions to complete
+struct worker_pool
+{
+	// starts num_threads threads. 0 means one per hardware thread
+	explicit worker_pool(int num_threads = 0);
+	~worker_pool();
+
+	worker_pool(worker_pool const&) = delete;
+	worker_pool& operator=(worker_pool const&) = delete;
+
+	int size() const { return int(_threads.size()); }
+
+	// runs f on one of the threads. f must not throw
+	void post(std::function<void()> f);
+
+private:
+
+	void run();
+
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	std::deque<std::function<void()>> _queue;
+	bool _stop = false;
+	std::vector<std::thread> _threads;
+};
+
+// like copy(), but the copy is split into chunks, aligned to page boundaries
+// in the source, which are copied in parallel by the calling thread and the
+// threads in pool. Each chunk is copied under its own protection scope, and
+// with flags applied to that chunk only (so populate_source pages in the
+// chunks in parallel too).
+//
+// It returns the lowest offset at which a fault happened (or len). Every byte
+// before that offset has been copied, and ec is set to the error. Bytes after
+// it may or may not have been copied.
+//
+// It's safe to call this from one of pool's threads. The calling thread only
+// waits for chunks that are being copied by other threads.
+std::size_t parallel_copy(void* dst, void const* src, std::size_t len
+	, worker_pool& pool, std::error_code& ec, std::uint32_t flags = 0);
+std::size_t parallel_copy(void* dst, void const* src, std::size_t len
+	, worker_pool& pool);
+
+} // namespace sig
+
+#endif
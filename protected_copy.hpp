@@ -0,0 +1,126 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef PROTECTED_COPY_HPP_INCLUDED
+#define PROTECTED_COPY_HPP_INCLUDED
+
+#include <cstddef> // for size_t
+#include <system_error>
+
+#include "copy.hpp"
+
+#if defined __has_include
+#if __has_include(<coroutine>) && defined __cpp_impl_coroutine
+#define TRY_SIGNAL_COROUTINES 1
+#endif
+#endif
+
+#if TRY_SIGNAL_COROUTINES
+
+#include <coroutine>
+
+namespace sig {
+
+// the outcome of a protected_copy(). bytes is the number of bytes copied
+// before the first fault, and error is set if the copy failed. See sig::copy()
+struct copy_result
+{
+	std::size_t bytes = 0;
+	std::error_code error;
+};
+
+// the awaitable returned by protected_copy(dst, src, len). It never suspends,
+// the copy runs on the thread that awaits it
+struct inline_copy
+{
+	bool await_ready() const noexcept { return true; }
+	void await_suspend(std::coroutine_handle<>) const noexcept {}
+	copy_result await_resume() const noexcept
+	{
+		copy_result ret;
+		ret.bytes = sig::copy(_dst, _src, _len, ret.error);
+		return ret;
+	}
+
+	void* _dst;
+	void const* _src;
+	std::size_t _len;
+};
+
+// the awaitable returned by protected_copy(dst, src, len, ex). It suspends the
+// coroutine and posts the copy to the executor. The coroutine is resumed on
+// the executor's thread once the copy is done
+template <typename Executor>
+struct posted_copy
+{
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		_ex.post([this, h] {
+			_result.bytes = sig::copy(_dst, _src, _len, _result.error);
+			h.resume();
+		});
+	}
+	copy_result await_resume() const noexcept { return _result; }
+
+	Executor& _ex;
+	void* _dst;
+	void const* _src;
+	std::size_t _len;
+	copy_result _result;
+};
+
+// co_await protected_copy(dst, src, len) copies len bytes from src to dst,
+// with the same protection and partial results as sig::copy().
+//
+// Each copy is protected by its own try_signal() scope, on the thread
+// performing it, so no scope ever spans a suspension point.
+inline inline_copy protected_copy(void* dst, void const* src, std::size_t len)
+{
+	return inline_copy{dst, src, len};
+}
+
+// like protected_copy(dst, src, len), but the copy runs on the executor. ex
+// must have a post() member function accepting a nullary function object,
+// and outlive the copy
+template <typename Executor>
+posted_copy<Executor> protected_copy(void* dst, void const* src
+	, std::size_t len, Executor& ex)
+{
+	return posted_copy<Executor>{ex, dst, src, len, {}};
+}
+
+} // namespace sig
+
+#endif // TRY_SIGNAL_COROUTINES
+
+#endif
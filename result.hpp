@@ -0,0 +1,226 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef RESULT_HPP_INCLUDED
+#define RESULT_HPP_INCLUDED
+
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include <cassert>
+
+namespace sig {
+
+// the tag selecting the error constructor of result<>. It keeps
+// result<std::error_code> unambiguous
+struct in_error_t { explicit in_error_t() = default; };
+constexpr in_error_t in_error{};
+
+namespace detail {
+
+	// owns the in-place value of a result<>, and knows how to copy and move it
+	template <typename T>
+	struct result_storage
+	{
+		explicit result_storage(std::error_code const ec) : _ec(ec), _has_value(false) {}
+
+		result_storage(result_storage const& r) : _ec(r._ec), _has_value(false)
+		{
+			if (r._has_value) construct(r.get());
+		}
+
+		result_storage(result_storage&& r)
+			noexcept(std::is_nothrow_move_constructible<T>::value)
+			: _ec(r._ec), _has_value(false)
+		{
+			if (r._has_value) construct(std::move(r.get()));
+		}
+
+		// assignment destroys the current value and constructs a new one, so
+		// T only needs to be constructible. If that throws, the result is left
+		// without a value
+		result_storage& operator=(result_storage const& r)
+		{
+			if (this == &r) return *this;
+			reset();
+			_ec = r._ec;
+			if (r._has_value) construct(r.get());
+			return *this;
+		}
+
+		result_storage& operator=(result_storage&& r)
+			noexcept(std::is_nothrow_move_constructible<T>::value)
+		{
+			if (this == &r) return *this;
+			reset();
+			_ec = r._ec;
+			if (r._has_value) construct(std::move(r.get()));
+			return *this;
+		}
+
+		~result_storage() { reset(); }
+
+		template <typename... Args>
+		void construct(Args&&... args)
+		{
+			new (_storage) T(std::forward<Args>(args)...);
+			_has_value = true;
+		}
+
+		void reset()
+		{
+			if (_has_value) get().~T();
+			_has_value = false;
+		}
+
+		T& get() { return *reinterpret_cast<T*>(_storage); }
+		T const& get() const { return *reinterpret_cast<T const*>(_storage); }
+
+		alignas(T) unsigned char _storage[sizeof(T)];
+		std::error_code _ec;
+		bool _has_value;
+	};
+
+	// a base class that deletes the copy (and move) operations of result<T>
+	// when T doesn't support them. Since result<T> defaults its own, they are
+	// defined as deleted too, and std::is_copy_constructible<> is accurate
+	template <bool Copy, bool Move>
+	struct result_copy_move {};
+
+	template <>
+	struct result_copy_move<false, true>
+	{
+		result_copy_move() = default;
+		result_copy_move(result_copy_move const&) = delete;
+		result_copy_move(result_copy_move&&) = default;
+		result_copy_move& operator=(result_copy_move const&) = delete;
+		result_copy_move& operator=(result_copy_move&&) = default;
+	};
+
+	template <>
+	struct result_copy_move<false, false>
+	{
+		result_copy_move() = default;
+		result_copy_move(result_copy_move const&) = delete;
+		result_copy_move(result_copy_move&&) = delete;
+		result_copy_move& operator=(result_copy_move const&) = delete;
+		result_copy_move& operator=(result_copy_move&&) = delete;
+	};
+
+} // namespace detail
+
+// holds either a value of type T or an error_code. It's what
+// try_signal_result() returns. The value is stored in-place, it's never
+// allocated on the heap. T may be a move-only type, in which case the result
+// is move-only too
+template <typename T>
+struct result
+	: private detail::result_storage<T>
+	, private detail::result_copy_move<std::is_copy_constructible<T>::value
+		, std::is_move_constructible<T>::value>
+{
+	static_assert(!std::is_reference<T>::value, "result<> does not hold references");
+
+	result(T const& v) : detail::result_storage<T>(std::error_code()) { this->construct(v); }
+	result(T&& v) : detail::result_storage<T>(std::error_code()) { this->construct(std::move(v)); }
+
+	// construct a result without a value. Unless ec is an error, it must be
+	// given a value with emplace() before it's used
+	result(in_error_t, std::error_code const ec) : detail::result_storage<T>(ec) {}
+
+	result(result const&) = default;
+	result(result&&) = default;
+	result& operator=(result const&) = default;
+	result& operator=(result&&) = default;
+
+	template <typename... Args>
+	void emplace(Args&&... args)
+	{
+		this->reset();
+		this->construct(std::forward<Args>(args)...);
+		this->_ec.clear();
+	}
+
+	explicit operator bool() const { return this->_has_value; }
+	bool has_value() const { return this->_has_value; }
+	std::error_code error() const { return this->_ec; }
+
+	T& value() & { assert(this->_has_value); return this->get(); }
+	T const& value() const& { assert(this->_has_value); return this->get(); }
+	T&& value() && { assert(this->_has_value); return std::move(this->get()); }
+
+	T& operator*() & { return value(); }
+	T const& operator*() const& { return value(); }
+	T&& operator*() && { return std::move(*this).value(); }
+	T* operator->() { return &value(); }
+	T const* operator->() const { return &value(); }
+};
+
+// the result of a protected call to a function returning void
+template <>
+struct result<void>
+{
+	result() : _has_value(true) {}
+	result(in_error_t, std::error_code const ec) : _ec(ec), _has_value(false) {}
+
+	void emplace() { _has_value = true; _ec.clear(); }
+
+	explicit operator bool() const { return _has_value; }
+	bool has_value() const { return _has_value; }
+	std::error_code error() const { return _ec; }
+
+private:
+	std::error_code _ec;
+	bool _has_value;
+};
+
+namespace detail {
+
+	// the type of result try_signal_result(f) returns
+	template <typename Fun>
+	using result_type = result<typename std::decay<
+		decltype(std::declval<Fun&>()())>::type>;
+
+	// calls f() and stores its return value in r. If f() doesn't return
+	// (because of a signal), r is left without a value
+	template <typename T, typename Fun>
+	void call_into(result<T>& r, Fun& f) { r.emplace(f()); }
+
+	template <typename Fun>
+	void call_into(result<void>& r, Fun& f) { f(); r.emplace(); }
+
+} // namespace detail
+
+} // namespace sig
+
+#endif
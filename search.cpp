@@ -0,0 +1,420 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+
+#include "search.hpp"
+#include "try_signal.hpp"
+#include "simd.hpp"
+
+namespace sig {
+
+namespace {
+
+// like the copy kernels, the scan kernels scan from done, one block at a
+// time, and advance done after each block that has no match. They return the
+// offset of the first match, or len if there is none. When a kernel is
+// interrupted by a fault, done is the offset of the block that failed. For
+// find(), done and the return value are the offsets of candidate matches
+using compare_kernel = std::size_t (*)(char const* a, char const* b
+	, std::size_t len, std::size_t volatile& done);
+using find_byte_kernel = std::size_t (*)(char const* buf, std::size_t len
+	, char c, std::size_t volatile& done);
+using find_kernel = std::size_t (*)(char const* buf, std::size_t len
+	, char const* pattern, std::size_t pattern_len, std::size_t volatile& done);
+
+// the most any of the kernels advance done by at a time
+std::size_t const max_block = 128;
+
+std::size_t compare_scalar(char const* a, char const* b, std::size_t const len
+	, std::size_t volatile& done)
+{
+	for (std::size_t i = done; i < len; i += max_block)
+	{
+		std::size_t const n = std::min(max_block, len - i);
+		if (std::memcmp(a + i, b + i, n) != 0)
+		{
+			std::size_t k = 0;
+			while (a[i + k] == b[i + k]) ++k;
+			return i + k;
+		}
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + n;
+	}
+	return len;
+}
+
+std::size_t find_byte_scalar(char const* buf, std::size_t const len
+	, char const c, std::size_t volatile& done)
+{
+	for (std::size_t i = done; i < len; i += max_block)
+	{
+		std::size_t const n = std::min(max_block, len - i);
+		void const* match = std::memchr(buf + i, c, n);
+		if (match != nullptr)
+			return std::size_t(static_cast<char const*>(match) - buf);
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + n;
+	}
+	return len;
+}
+
+std::size_t find_scalar(char const* buf, std::size_t const len
+	, char const* pattern, std::size_t const pattern_len, std::size_t volatile& done)
+{
+	std::size_t const candidates = len - pattern_len + 1;
+	for (std::size_t i = done; i < candidates; i += max_block)
+	{
+		std::size_t const n = std::min(max_block, candidates - i);
+		char const* end = buf + i + n + pattern_len - 1;
+		char const* match = std::search(buf + i, end, pattern, pattern + pattern_len);
+		if (match != end) return std::size_t(match - buf);
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + n;
+	}
+	return len;
+}
+
+#if TRY_SIGNAL_SSE2
+std::size_t compare_sse2(char const* a, char const* b, std::size_t const len
+	, std::size_t volatile& done)
+{
+	std::size_t i = done;
+	for (; len - i >= 64; i += 64)
+	{
+		__m128i const* x = reinterpret_cast<__m128i const*>(a + i);
+		__m128i const* y = reinterpret_cast<__m128i const*>(b + i);
+		__m128i const e0 = _mm_cmpeq_epi8(_mm_loadu_si128(x), _mm_loadu_si128(y));
+		__m128i const e1 = _mm_cmpeq_epi8(_mm_loadu_si128(x + 1), _mm_loadu_si128(y + 1));
+		__m128i const e2 = _mm_cmpeq_epi8(_mm_loadu_si128(x + 2), _mm_loadu_si128(y + 2));
+		__m128i const e3 = _mm_cmpeq_epi8(_mm_loadu_si128(x + 3), _mm_loadu_si128(y + 3));
+		__m128i const all = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+		if (_mm_movemask_epi8(all) != 0xffff)
+		{
+			__m128i const eq[] = { e0, e1, e2, e3 };
+			for (int k = 0;; ++k)
+			{
+				unsigned const diff = unsigned(_mm_movemask_epi8(eq[k])) ^ 0xffffu;
+				if (diff != 0) return i + std::size_t(k) * 16 + detail::first_bit(diff);
+			}
+		}
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + 64;
+	}
+	return compare_scalar(a, b, len, done);
+}
+
+std::size_t find_byte_sse2(char const* buf, std::size_t const len
+	, char const c, std::size_t volatile& done)
+{
+	__m128i const needle = _mm_set1_epi8(c);
+	std::size_t i = done;
+	for (; len - i >= 64; i += 64)
+	{
+		__m128i const* s = reinterpret_cast<__m128i const*>(buf + i);
+		__m128i const e0 = _mm_cmpeq_epi8(_mm_loadu_si128(s), needle);
+		__m128i const e1 = _mm_cmpeq_epi8(_mm_loadu_si128(s + 1), needle);
+		__m128i const e2 = _mm_cmpeq_epi8(_mm_loadu_si128(s + 2), needle);
+		__m128i const e3 = _mm_cmpeq_epi8(_mm_loadu_si128(s + 3), needle);
+		__m128i const any = _mm_or_si128(_mm_or_si128(e0, e1), _mm_or_si128(e2, e3));
+		if (_mm_movemask_epi8(any) != 0)
+		{
+			__m128i const eq[] = { e0, e1, e2, e3 };
+			for (int k = 0;; ++k)
+			{
+				unsigned const match = unsigned(_mm_movemask_epi8(eq[k]));
+				if (match != 0) return i + std::size_t(k) * 16 + detail::first_bit(match);
+			}
+		}
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + 64;
+	}
+	return find_byte_scalar(buf, len, c, done);
+}
+
+// finds candidates by comparing the first and last byte of the pattern, 16
+// candidates at a time, and only compares the whole pattern for those
+std::size_t find_sse2(char const* buf, std::size_t const len
+	, char const* pattern, std::size_t const pattern_len, std::size_t volatile& done)
+{
+	__m128i const first = _mm_set1_epi8(pattern[0]);
+	__m128i const last = _mm_set1_epi8(pattern[pattern_len - 1]);
+	std::size_t i = done;
+	for (; len - i >= 16 + pattern_len - 1; i += 16)
+	{
+		__m128i const f = _mm_cmpeq_epi8(first
+			, _mm_loadu_si128(reinterpret_cast<__m128i const*>(buf + i)));
+		__m128i const l = _mm_cmpeq_epi8(last
+			, _mm_loadu_si128(reinterpret_cast<__m128i const*>(buf + i + pattern_len - 1)));
+		unsigned mask = unsigned(_mm_movemask_epi8(_mm_and_si128(f, l)));
+		while (mask != 0)
+		{
+			std::size_t const p = i + detail::first_bit(mask);
+			if (std::memcmp(buf + p + 1, pattern + 1, pattern_len - 2) == 0) return p;
+			mask &= mask - 1;
+		}
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + 16;
+	}
+	return find_scalar(buf, len, pattern, pattern_len, done);
+}
+#endif
+
+#if TRY_SIGNAL_AVX2
+__attribute__((target("avx2")))
+std::size_t compare_avx2(char const* a, char const* b, std::size_t const len
+	, std::size_t volatile& done)
+{
+	std::size_t i = done;
+	for (; len - i >= 64; i += 64)
+	{
+		__m256i const* x = reinterpret_cast<__m256i const*>(a + i);
+		__m256i const* y = reinterpret_cast<__m256i const*>(b + i);
+		unsigned const diff0 = ~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_loadu_si256(x), _mm256_loadu_si256(y))));
+		unsigned const diff1 = ~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_loadu_si256(x + 1), _mm256_loadu_si256(y + 1))));
+		if (diff0 != 0) return i + detail::first_bit(diff0);
+		if (diff1 != 0) return i + 32 + detail::first_bit(diff1);
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + 64;
+	}
+	return compare_sse2(a, b, len, done);
+}
+
+__attribute__((target("avx2")))
+std::size_t find_byte_avx2(char const* buf, std::size_t const len
+	, char const c, std::size_t volatile& done)
+{
+	__m256i const needle = _mm256_set1_epi8(c);
+	std::size_t i = done;
+	for (; len - i >= 128; i += 128)
+	{
+		__m256i const* s = reinterpret_cast<__m256i const*>(buf + i);
+		__m256i const e0 = _mm256_cmpeq_epi8(_mm256_loadu_si256(s), needle);
+		__m256i const e1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(s + 1), needle);
+		__m256i const e2 = _mm256_cmpeq_epi8(_mm256_loadu_si256(s + 2), needle);
+		__m256i const e3 = _mm256_cmpeq_epi8(_mm256_loadu_si256(s + 3), needle);
+		__m256i const any = _mm256_or_si256(_mm256_or_si256(e0, e1), _mm256_or_si256(e2, e3));
+		if (!_mm256_testz_si256(any, any))
+		{
+			__m256i const eq[] = { e0, e1, e2, e3 };
+			for (int k = 0;; ++k)
+			{
+				unsigned const match = unsigned(_mm256_movemask_epi8(eq[k]));
+				if (match != 0) return i + std::size_t(k) * 32 + detail::first_bit(match);
+			}
+		}
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + 128;
+	}
+	return find_byte_sse2(buf, len, c, done);
+}
+
+__attribute__((target("avx2")))
+std::size_t find_avx2(char const* buf, std::size_t const len
+	, char const* pattern, std::size_t const pattern_len, std::size_t volatile& done)
+{
+	__m256i const first = _mm256_set1_epi8(pattern[0]);
+	__m256i const last = _mm256_set1_epi8(pattern[pattern_len - 1]);
+	std::size_t i = done;
+	for (; len - i >= 64 + pattern_len - 1; i += 64)
+	{
+		for (std::size_t half = 0; half < 64; half += 32)
+		{
+			__m256i const f = _mm256_cmpeq_epi8(first
+				, _mm256_loadu_si256(reinterpret_cast<__m256i const*>(buf + i + half)));
+			__m256i const l = _mm256_cmpeq_epi8(last, _mm256_loadu_si256(
+				reinterpret_cast<__m256i const*>(buf + i + half + pattern_len - 1)));
+			unsigned mask = unsigned(_mm256_movemask_epi8(_mm256_and_si256(f, l)));
+			while (mask != 0)
+			{
+				std::size_t const p = i + half + detail::first_bit(mask);
+				if (std::memcmp(buf + p + 1, pattern + 1, pattern_len - 2) == 0) return p;
+				mask &= mask - 1;
+			}
+		}
+		std::atomic_signal_fence(std::memory_order_release);
+		done = i + 64;
+	}
+	return find_sse2(buf, len, pattern, pattern_len, done);
+}
+#endif
+
+struct scan_kernels
+{
+	compare_kernel compare;
+	find_byte_kernel find_byte;
+	find_kernel find;
+};
+
+scan_kernels select_kernels()
+{
+#if TRY_SIGNAL_AVX2
+	if (detail::has_avx2())
+		return scan_kernels{&compare_avx2, &find_byte_avx2, &find_avx2};
+#endif
+#if TRY_SIGNAL_SSE2
+	return scan_kernels{&compare_sse2, &find_byte_sse2, &find_sse2};
+#else
+	return scan_kernels{&compare_scalar, &find_byte_scalar, &find_scalar};
+#endif
+}
+
+scan_kernels const& default_kernels()
+{
+	static scan_kernels const kernels = select_kernels();
+	return kernels;
+}
+
+// runs scan() (a kernel) under try_signal(). If it faults, rescue() scans the
+// block that failed again, one byte at a time, through volatile pointers, and
+// advances position past every byte it reads. It returns the offset of the
+// first match in the block, or len if there is none. If rescue() faults too,
+// position is the offset of the byte that faulted
+template <typename Scan, typename Rescue>
+search_result protected_scan(std::size_t const len, std::size_t volatile& position
+	, Scan scan, Rescue rescue)
+{
+	search_result ret;
+	for (;;)
+	{
+		std::size_t found = len;
+		ret.error = sig::try_signal_noexcept([&]{ found = scan(); });
+		if (!ret.error)
+		{
+			ret.offset = found;
+			return ret;
+		}
+
+		ret.error = sig::try_signal_noexcept([&]{ found = rescue(); });
+		if (ret.error)
+		{
+			ret.offset = position;
+			return ret;
+		}
+		if (found != len)
+		{
+			ret.offset = found;
+			return ret;
+		}
+		// the fault did not happen again. Keep going
+	}
+}
+
+} // anonymous namespace
+
+search_result compare(void const* a, void const* b, std::size_t const len)
+{
+	compare_kernel const kernel = default_kernels().compare;
+	char const* const x = static_cast<char const*>(a);
+	char const* const y = static_cast<char const*>(b);
+	std::size_t volatile done = 0;
+	return protected_scan(len, done
+		, [&]{ return kernel(x, y, len, done); }
+		, [&]{
+			char const volatile* vx = x;
+			char const volatile* vy = y;
+			std::size_t const end = std::min(len, done + max_block);
+			for (std::size_t i = done; i < end; ++i)
+			{
+				if (vx[i] != vy[i]) return i;
+				done = i + 1;
+			}
+			return len;
+		});
+}
+
+search_result find_byte(void const* buf, std::size_t const len, char const c)
+{
+	find_byte_kernel const kernel = default_kernels().find_byte;
+	char const* const b = static_cast<char const*>(buf);
+	std::size_t volatile done = 0;
+	return protected_scan(len, done
+		, [&]{ return kernel(b, len, c, done); }
+		, [&]{
+			char const volatile* vb = b;
+			std::size_t const end = std::min(len, done + max_block);
+			for (std::size_t i = done; i < end; ++i)
+			{
+				if (vb[i] == c) return i;
+				done = i + 1;
+			}
+			return len;
+		});
+}
+
+search_result find(void const* buf, std::size_t const len, void const* pattern
+	, std::size_t const pattern_len)
+{
+	if (pattern_len == 0) return search_result();
+	if (pattern_len == 1)
+		return find_byte(buf, len, *static_cast<char const*>(pattern));
+
+	search_result ret;
+	if (len < pattern_len)
+	{
+		ret.offset = len;
+		return ret;
+	}
+
+	find_kernel const kernel = default_kernels().find;
+	char const* const b = static_cast<char const*>(buf);
+	char const* const p = static_cast<char const*>(pattern);
+	// done is the next candidate match, readable the number of bytes the
+	// rescue pass has read
+	std::size_t volatile done = 0;
+	std::size_t volatile readable = 0;
+	return protected_scan(len, readable
+		, [&]{ return kernel(b, len, p, pattern_len, done); }
+		, [&]{
+			// read the bytes in order, and check each candidate as soon as all
+			// of its bytes have been read
+			char const volatile* vb = b;
+			std::size_t const end = std::min(len, done + max_block + pattern_len - 1);
+			readable = done;
+			for (std::size_t i = done; i < end; ++i)
+			{
+				static_cast<void>(vb[i]);
+				readable = i + 1;
+				if (i + 1 < done + pattern_len) continue;
+				std::size_t const candidate = i + 1 - pattern_len;
+				if (std::memcmp(b + candidate, p, pattern_len) == 0) return candidate;
+				done = candidate + 1;
+			}
+			return len;
+		});
+}
+
+} // namespace sig
@@ -0,0 +1,76 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef SEARCH_HPP_INCLUDED
+#define SEARCH_HPP_INCLUDED
+
+#include <cstddef> // for size_t
+#include <system_error>
+
+namespace sig {
+
+// the outcome of a protected scan
+struct search_result
+{
+	// the offset of the match (or of the first difference, for compare()),
+	// or the length of the range if there is none. If the scan failed, this is
+	// the offset of the byte that faulted, and there's no match before it
+	std::size_t offset = 0;
+
+	// set if the scan failed
+	std::error_code error;
+};
+
+// these scan memory (typically a memory mapped file) under a single
+// protection scope, with SSE2 or AVX2 where available, and stop at the first
+// match or the first fault, whichever comes first. Unlike wrapping
+// std::memchr() or std::search() in try_signal(), a fault is reported with its
+// exact offset, and any match before it is still found.
+
+// compares the ranges [a, a + len) and [b, b + len), and returns the offset of
+// the first byte that differs. The order of the ranges can be found by
+// comparing the bytes at that offset. A fault in either range stops the
+// comparison
+search_result compare(void const* a, void const* b, std::size_t len);
+
+// returns the offset of the first byte in [buf, buf + len) equal to c
+search_result find_byte(void const* buf, std::size_t len, char c);
+
+// returns the offset of the first occurrence of [pattern, pattern + pattern_len)
+// in [buf, buf + len). An empty pattern is found at offset 0. The pattern
+// itself must be accessible
+search_result find(void const* buf, std::size_t len, void const* pattern
+	, std::size_t pattern_len);
+
+} // namespace sig
+
+#endif
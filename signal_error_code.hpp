@@ -34,6 +34,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #define SIGNAL_ERROR_CODE_HPP_INCLUDED
 
 #include <signal.h>
+#include <cstddef> // for size_t
 #include <system_error>
 
 #ifdef _WIN32
@@ -141,6 +142,65 @@ std::error_category& seh_category();
 
 #endif // _WIN32
 
+// the signals caught by a try_signal() scope. A combination of these can be
+// passed as the first template argument to try_signal(),
+// try_signal_noexcept(), try_signal_result() and try_signal_batch(), e.g.
+// try_signal<sig::catch_fpe | sig::catch_segv>(f). A signal that isn't caught
+// by a scope is handled by the closest enclosing scope that catches it (or is
+// fatal, if there isn't one). On windows, they select the corresponding
+// structured exceptions.
+enum catch_signals : unsigned
+{
+	// SIGSEGV: access to unmapped or protected memory
+	catch_segv = 1,
+	// SIGBUS: e.g. access to a page of a mapped file that failed to be read,
+	// or is past the end of the file
+	catch_bus = 2,
+	// SIGFPE: e.g. integer division by zero, or floating point exceptions that
+	// have been unmasked
+	catch_fpe = 4,
+	// SIGILL: illegal instruction
+	catch_ill = 8,
+
+	// the signals caught if none are specified
+	catch_default = catch_segv | catch_bus
+};
+
+// details about a caught signal (or structured exception), beyond its error
+// code
+struct fault_info
+{
+	// the address whose access caused the fault, or nullptr if it's not known
+	void* address = nullptr;
+
+	// on POSIX, this is si_code from siginfo_t, e.g. BUS_ADRERR vs. BUS_OBJERR
+	// or SEGV_MAPERR vs. SEGV_ACCERR. On windows it is the kind of access that
+	// failed, for access violations and in-page errors (0 = read, 1 = write,
+	// 8 = DEP violation)
+	int reason = 0;
+
+	// the size of the block of memory the fault covers, or 0 if it's not
+	// known (in which case it's a page). The block is aligned to its size. On
+	// linux, memory errors (BUS_MCEERR_AR and BUS_MCEERR_AO) report it, and in
+	// mappings backed by huge pages, it's a whole huge page
+	std::size_t extent = 0;
+};
+
+// this is the exception thrown by try_signal(). Since it derives from
+// std::system_error, it can be caught as one
+struct fault_error : std::system_error
+{
+	fault_error(std::error_code const ec, fault_info const& info)
+		: std::system_error(ec), _info(info) {}
+
+	void* address() const noexcept { return _info.address; }
+	int reason() const noexcept { return _info.reason; }
+	std::size_t extent() const noexcept { return _info.extent; }
+
+private:
+	fault_info _info;
+};
+
 } // namespace sig
 
 namespace std
@@ -0,0 +1,97 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef SIMD_HPP_INCLUDED
+#define SIMD_HPP_INCLUDED
+
+// this header is internal to the library. It detects the instruction sets the
+// kernels in copy.cpp and search.cpp may use
+
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define TRY_SIGNAL_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if TRY_SIGNAL_SSE2 && defined __GNUC__
+// the AVX2 kernels are compiled with the target attribute and only selected at
+// run time, if the CPU supports it
+#define TRY_SIGNAL_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if TRY_SIGNAL_SSE2 && defined __GNUC__ && defined __x86_64__
+// like the AVX2 kernels, the SSE4.2 CRC32C functions are selected at run time
+#define TRY_SIGNAL_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+#if defined __ARM_FEATURE_CRC32
+#define TRY_SIGNAL_ARM_CRC 1
+#include <arm_acle.h>
+#endif
+
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace sig {
+namespace detail {
+
+// the index of the lowest set bit in mask, which must not be 0. This is how
+// the kernels find the first matching byte from a movemask
+inline unsigned first_bit(unsigned const mask)
+{
+#if defined __GNUC__
+	return unsigned(__builtin_ctz(mask));
+#elif defined _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return unsigned(index);
+#else
+	unsigned index = 0;
+	while (!(mask & (1u << index))) ++index;
+	return index;
+#endif
+}
+
+#if TRY_SIGNAL_AVX2
+inline bool has_avx2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+} // namespace detail
+} // namespace sig
+
+#endif
@@ -0,0 +1,87 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TRY_SIGNAL_STATS_HPP_INCLUDED
+#define TRY_SIGNAL_STATS_HPP_INCLUDED
+
+#include <cstdint>
+
+namespace sig {
+
+// counters of the activity of try_signal() and the signal handler, summed up
+// across all threads (including threads that have exited).
+//
+// They are only collected when the library (and everything including its
+// headers) is built with TRY_SIGNAL_STATS defined to 1. Otherwise,
+// stats_snapshot() returns all zeros, and collecting them costs nothing.
+// Currently, they are only collected on POSIX systems.
+struct stats
+{
+	enum
+	{
+		// the number of signal numbers faults are counted for
+		max_signal = 32,
+		// the number of si_code values faults are counted for. Faults with
+		// other codes are counted in the last one
+		max_reason = 8,
+		// the number of buckets in the latency histogram
+		latency_buckets = 32
+	};
+
+	// the number of protection scopes entered. One per call to try_signal(),
+	// try_signal_noexcept(), try_signal_result() and try_signal_batch()
+	std::uint64_t calls = 0;
+
+	// the number of times the signal handler was invoked, by signal number
+	// and si_code (see fault_info::reason)
+	std::uint64_t faults[max_signal][max_reason] = {};
+
+	// the number of faults fixed by a fault resolver
+	std::uint64_t resolved = 0;
+
+	// the deepest nesting of protection scopes seen on any thread
+	std::uint64_t max_depth = 0;
+
+	// a histogram of the time from the signal handler being invoked to the
+	// fault being caught by try_signal(). latency[i] counts the faults that
+	// took between 2^i and 2^(i+1) nanoseconds
+	std::uint64_t latency[latency_buckets] = {};
+};
+
+// sums up the counters of all threads. This doesn't take any locks, and may
+// run concurrently with faults being counted. The counters of a thread may be
+// slightly behind
+stats stats_snapshot();
+
+} // namespace sig
+
+#endif
@@ -0,0 +1,286 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib> // for atoi
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <string>
+
+#include "try_signal.hpp"
+#include "copy.hpp"
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+// injects faults into the protected copy path, and measures how it copes.
+// Every thread copies pages out of a region, in a deterministic order. The
+// pages that fault are chosen deterministically too, so every copy's outcome
+// is known in advance, and checked. The scenarios are:
+//
+//	mprotect     a fraction of the pages are PROT_NONE (SIGSEGV)
+//	truncate     a file mapping, with the file truncated to cover only part of
+//	             it (SIGBUS)
+//	shrink       a file mapping, while another process keeps shrinking and
+//	             growing the file. The outcomes can't be predicted here, only
+//	             that the process survives
+//
+// It prints its results in the same CSV layout as bench, one measurement per
+// line:
+//
+//	benchmark,parameter,value,unit
+//
+// The benchmark is the scenario followed by what's measured: the copy
+// throughput, the rate of faults and percentiles of the time each copy took.
+// The parameter is the fault rate, in percent (blank for shrink, where it's
+// unknown)
+//
+// usage: stress [threads] [copies per thread]
+
+namespace {
+
+void report(char const* scenario, char const* measurement
+	, std::string const& parameter, double const value, char const* unit)
+{
+	std::printf("%s_%s,%s,%.2f,%s\n", scenario, measurement, parameter.c_str()
+		, value, unit);
+}
+
+using clock_type = std::chrono::steady_clock;
+
+std::size_t const num_pages = 1024;
+
+std::size_t page_size()
+{
+	static std::size_t const size = std::size_t(sysconf(_SC_PAGESIZE));
+	return size;
+}
+
+// a deterministic sequence of page indices (a linear congruential generator)
+struct page_sequence
+{
+	explicit page_sequence(std::uint32_t const seed) : _state(seed * 2654435761u + 1) {}
+	std::size_t next()
+	{
+		_state = _state * 1664525u + 1013904223u;
+		return (_state >> 8) % num_pages;
+	}
+private:
+	std::uint32_t _state;
+};
+
+// whether page i faults at the given fault rate (in percent). The bad pages
+// are spread over the region, rather than all at the end
+bool is_bad(std::size_t const i, int const rate)
+{
+	return (i * 37 + 11) % 100 < std::size_t(rate);
+}
+
+struct thread_result
+{
+	std::vector<std::uint32_t> latency;
+	std::size_t bytes = 0;
+	std::size_t faults = 0;
+	bool ok = true;
+};
+
+// runs num_threads threads, each copying copies pages out of region, all at
+// the same time. expect(page) returns 1 if copying the page must succeed, 0
+// if it must fault, and -1 if either is fine. Prints the results
+template <typename Expect>
+bool run(char const* scenario, int const rate, char const* region
+	, int const num_threads, int const copies, Expect expect)
+{
+	std::atomic<int> ready(0);
+	std::atomic<bool> start(false);
+	std::vector<thread_result> results(static_cast<std::size_t>(num_threads));
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; ++t)
+	{
+		threads.emplace_back([&, t]{
+			thread_result& r = results[std::size_t(t)];
+			r.latency.reserve(std::size_t(copies));
+			std::vector<char> buf(page_size());
+			page_sequence seq(static_cast<std::uint32_t>(t));
+			++ready;
+			while (!start) std::this_thread::yield();
+			for (int i = 0; i < copies; ++i)
+			{
+				std::size_t const page = seq.next();
+				std::error_code ec;
+				auto const begin = clock_type::now();
+				std::size_t const n = sig::copy(buf.data(), region + page * page_size()
+					, page_size(), ec);
+				auto const end = clock_type::now();
+				r.latency.push_back(std::uint32_t(std::min<std::int64_t>(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()
+					, 0xffffffff)));
+				r.bytes += n;
+				if (ec) ++r.faults;
+				int const e = expect(page);
+				if (e >= 0 && (e == 1) != (!ec && n == page_size())) r.ok = false;
+			}
+		});
+	}
+	while (ready != num_threads) std::this_thread::yield();
+
+	auto const begin = clock_type::now();
+	start = true;
+	for (auto& t : threads) t.join();
+	double const seconds = std::chrono::duration<double>(clock_type::now() - begin).count();
+
+	std::vector<std::uint32_t> latency;
+	std::size_t bytes = 0;
+	std::size_t faults = 0;
+	bool ok = true;
+	for (thread_result const& r : results)
+	{
+		latency.insert(latency.end(), r.latency.begin(), r.latency.end());
+		bytes += r.bytes;
+		faults += r.faults;
+		ok = ok && r.ok;
+	}
+	std::sort(latency.begin(), latency.end());
+	auto percentile = [&](double const p) {
+		return latency[std::min(latency.size() - 1, std::size_t(double(latency.size()) * p))];
+	};
+
+	// the fault rate is unknown (and left blank) when it's negative
+	std::string const rate_str = rate < 0 ? std::string() : std::to_string(rate);
+	report(scenario, "copy", rate_str, double(bytes) / seconds / 1e6, "MB/s");
+	report(scenario, "faults", rate_str, double(faults) / seconds, "faults/s");
+	report(scenario, "latency_p50", rate_str, percentile(0.5), "ns");
+	report(scenario, "latency_p99", rate_str, percentile(0.99), "ns");
+	report(scenario, "latency_p999", rate_str, percentile(0.999), "ns");
+	report(scenario, "latency_max", rate_str, latency.back(), "ns");
+	std::fflush(stdout);
+	if (!ok) std::fprintf(stderr, "ERROR: unexpected copy result in %s at %d%%\n"
+		, scenario, rate);
+	return ok;
+}
+
+int const fault_rates[] = { 0, 1, 5, 10, 25, 50 };
+
+bool stress_mprotect(int const num_threads, int const copies)
+{
+	std::size_t const size = num_pages * page_size();
+	bool ok = true;
+	for (int const rate : fault_rates)
+	{
+		char* const region = static_cast<char*>(mmap(nullptr, size
+			, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (region == MAP_FAILED) return false;
+		std::memset(region, 'x', size);
+		for (std::size_t i = 0; i < num_pages; ++i)
+			if (is_bad(i, rate)) mprotect(region + i * page_size(), page_size(), PROT_NONE);
+
+		ok = run("mprotect", rate, region, num_threads, copies
+			, [&](std::size_t const page) { return is_bad(page, rate) ? 0 : 1; }) && ok;
+		munmap(region, size);
+	}
+	return ok;
+}
+
+// creates a file of num_pages pages and maps all of it. Returns the file
+// descriptor
+int map_file(char const* path, char** region)
+{
+	std::size_t const size = num_pages * page_size();
+	int const fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return -1;
+	std::vector<char> data(size, 'x');
+	if (write(fd, data.data(), size) != ssize_t(size))
+	{
+		close(fd);
+		return -1;
+	}
+	void* const ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED)
+	{
+		close(fd);
+		return -1;
+	}
+	*region = static_cast<char*>(ptr);
+	return fd;
+}
+
+bool stress_truncate(int const num_threads, int const copies)
+{
+	std::size_t const size = num_pages * page_size();
+	bool ok = true;
+	for (int const rate : fault_rates)
+	{
+		char* region = nullptr;
+		int const fd = map_file("stress_file", &region);
+		if (fd < 0) return false;
+
+		// the pages past the end of the file raise SIGBUS
+		std::size_t const good_pages = num_pages - num_pages * std::size_t(rate) / 100;
+		if (ftruncate(fd, off_t(good_pages * page_size())) != 0) ok = false;
+
+		ok = run("truncate", rate, region, num_threads, copies
+			, [&](std::size_t const page) { return page < good_pages ? 1 : 0; }) && ok;
+		munmap(region, size);
+		close(fd);
+		unlink("stress_file");
+	}
+	return ok;
+}
+
+bool stress_shrink(int const num_threads, int const copies)
+{
+	std::size_t const size = num_pages * page_size();
+	char* region = nullptr;
+	int const fd = map_file("stress_file", &region);
+	if (fd < 0) return false;
+
+	// the child process keeps shrinking the file to half its size and growing
+	// it back, until it's killed
+	pid_t const child = fork();
+	if (child == 0)
+	{
+		for (;;)
+		{
+			if (ftruncate(fd, off_t(size / 2)) != 0) _exit(1);
+			usleep(100);
+			if (ftruncate(fd, off_t(size)) != 0) _exit(1);
+			usleep(100);
+		}
+	}
+	if (child < 0) return false;
+
+	bool const ok = run("shrink", -1, region, num_threads, copies
+		, [](std::size_t) { return -1; });
+
+	kill(child, SIGKILL);
+	waitpid(child, nullptr, 0);
+	munmap(region, size);
+	close(fd);
+	unlink("stress_file");
+	return ok;
+}
+
+} // anonymous namespace
+
+int main(int argc, char const* argv[])
+{
+	int const num_threads = argc > 1 ? std::atoi(argv[1])
+		: int(std::max(4u, std::thread::hardware_concurrency()));
+	int const copies = argc > 2 ? std::atoi(argv[2]) : 20000;
+	if (num_threads <= 0 || copies <= 0)
+	{
+		std::fprintf(stderr, "usage: stress [threads] [copies per thread]\n");
+		return 1;
+	}
+
+	std::printf("benchmark,parameter,value,unit\n");
+	bool ok = stress_mprotect(num_threads, copies);
+	ok = stress_truncate(num_threads, copies) && ok;
+	ok = stress_shrink(num_threads, copies) && ok;
+	return ok ? 0 : 1;
+}
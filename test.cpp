@@ -1,14 +1,132 @@
 #include <stdexcept>
 #include <array>
 #include <cstring> // for memcpy
+#include <iterator> // for begin, end
+#include <vector>
+#include <string>
+#include <memory> // for unique_ptr
+#include <cstdint>
+#include <algorithm> // for count
+#include <thread>
+#include <chrono>
+#include <type_traits>
+#include <cerrno>
+#include <functional>
+#include <exception> // for terminate
+#include <cstdlib> // for exit
 
 #include "try_signal.hpp"
+#include "copy.hpp"
+#include "search.hpp"
+#include "parallel_copy.hpp"
+#include "protected_copy.hpp"
+
+#if !defined _WIN32
+#include "mapped_file.hpp"
+#include "mapped_writer.hpp"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <csignal> // for SIGSEGV
+#endif
+
+#if !defined _WIN32
+namespace {
+
+// recurses until the stack overflows
+int overflow(int depth)
+{
+	if (depth < 0) return 0;
+	char volatile frame[512];
+	frame[0] = char(depth);
+	return overflow(depth + 1) + frame[0];
+}
+
+void* overflow_thread(void* ret)
+{
+	sig::use_alt_stack();
+	std::error_code const ec = sig::try_signal_noexcept([]{ overflow(0); });
+	*static_cast<bool*>(ret) = ec == std::error_condition(sig::errors::segmentation);
+	return nullptr;
+}
+
+// two pages of private memory, the second of which can't be accessed. Exits
+// the test if they can't be set up
+struct guarded_region
+{
+	guarded_region()
+		: page(std::size_t(sysconf(_SC_PAGESIZE)))
+		, map(static_cast<char*>(mmap(nullptr, 2 * page, PROT_READ | PROT_WRITE
+			, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)))
+	{
+		if (map == MAP_FAILED || mprotect(map + page, page, PROT_NONE) != 0) {
+			fprintf(stderr, "ERROR: failed to set up a guard page\n");
+			std::exit(1);
+		}
+	}
+	~guarded_region() { munmap(map, 2 * page); }
+	guarded_region(guarded_region const&) = delete;
+	guarded_region& operator=(guarded_region const&) = delete;
+
+	std::size_t const page;
+	char* const map;
+};
+
+} // anonymous namespace
+#endif
+
+#if TRY_SIGNAL_COROUTINES && !defined _WIN32
+namespace {
+
+// a coroutine that runs eagerly and can't be awaited. It's all that's needed
+// to drive the awaitable copies
+struct detached
+{
+	struct promise_type
+	{
+		detached get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+// an executor that runs the posted functions when run() is called
+struct manual_executor
+{
+	void post(std::function<void()> f) { queue.push_back(std::move(f)); }
+	void run()
+	{
+		while (!queue.empty())
+		{
+			std::function<void()> f = std::move(queue.front());
+			queue.erase(queue.begin());
+			f();
+		}
+	}
+	std::vector<std::function<void()>> queue;
+};
+
+detached await_copies(char* dst, char const* src, std::size_t len
+	, manual_executor& ex, sig::copy_result* results)
+{
+	results[0] = co_await sig::protected_copy(dst, src, len);
+	results[1] = co_await sig::protected_copy(dst, src + 50, len, ex);
+}
+
+} // anonymous namespace
+#endif
 
 int main()
 {
 	char const buf[] = "test...test";
 	char dest[sizeof(buf)];
 
+	// an address we can't access. It's volatile to keep the compiler from
+	// warning about the (intentional) invalid accesses
+	char volatile* volatile const invalid_address = reinterpret_cast<char volatile*>(64);
+
 	{
 		sig::try_signal([&]{
 			std::memcpy(dest, buf, sizeof(buf));
@@ -19,6 +137,603 @@ int main()
 		}
 	}
 
+	// the signal mask must be restored after each fault, otherwise the second
+	// one would kill us
+	for (int i = 0; i < 3; ++i) {
+		try {
+			void* invalid_pointer = nullptr;
+			sig::try_signal([&]{
+				std::memcpy(dest, invalid_pointer, sizeof(buf));
+			});
+			fprintf(stderr, "ERROR: expected exception\n");
+			return 1;
+		}
+		catch (std::system_error const&) {}
+	}
+
+	try {
+		sig::try_signal([&]{ dest[0] = *invalid_address; });
+		fprintf(stderr, "ERROR: expected exception\n");
+		return 1;
+	}
+	catch (sig::fault_error const& e) {
+		if (e.address() != reinterpret_cast<void*>(64)) {
+			fprintf(stderr, "ERROR: unexpected fault address: %p\n", e.address());
+			return 1;
+		}
+	}
+
+	{
+		std::error_code const ec = sig::try_signal_noexcept([&]{
+			dest[0] = *invalid_address;
+		});
+		if (ec != std::error_condition(sig::errors::segmentation)) {
+			fprintf(stderr, "ERROR: expected segmentation violation error code\n");
+			return 1;
+		}
+
+		sig::result<std::unique_ptr<int>> r = sig::try_signal_result([]{
+			return std::unique_ptr<int>(new int(42));
+		});
+		if (!r || **r != 42) {
+			fprintf(stderr, "ERROR: expected value from try_signal_result()\n");
+			return 1;
+		}
+
+		sig::result<int> const failed = sig::try_signal_result([&]{
+			return int(*invalid_address);
+		});
+		if (failed || failed.error() != std::error_condition(sig::errors::segmentation)) {
+			fprintf(stderr, "ERROR: expected error from try_signal_result()\n");
+			return 1;
+		}
+
+		static_assert(!std::is_copy_constructible<sig::result<std::unique_ptr<int>>>::value
+			, "result<> of a move-only type must be move-only");
+		static_assert(std::is_nothrow_move_constructible<sig::result<std::unique_ptr<int>>>::value
+			, "result<> must be nothrow movable when T is");
+
+		sig::result<std::unique_ptr<int>> moved(std::unique_ptr<int>(new int(1)));
+		moved = std::move(r);
+		sig::result<int> copied = failed;
+		copied = sig::result<int>(3);
+		sig::result<std::error_code> const code = sig::try_signal_result([]{
+			return std::error_code(EINVAL, std::generic_category());
+		});
+		if (!moved || **moved != 42 || !copied || *copied != 3
+			|| !code || *code != std::errc::invalid_argument) {
+			fprintf(stderr, "ERROR: unexpected result<> after copy and move\n");
+			return 1;
+		}
+	}
+
+	{
+		std::vector<char> src(1000);
+		for (std::size_t i = 0; i < src.size(); ++i) src[i] = char(i * 7);
+		for (std::size_t len = 0; len < 300; len += 13) {
+			for (std::size_t offset = 0; offset < 16; offset += 3) {
+				std::vector<char> dst(src.size());
+				std::error_code ec;
+				if (sig::copy(dst.data() + 1, src.data() + offset, len, ec) != len
+					|| ec
+					|| !std::equal(dst.begin() + 1, dst.begin() + 1 + len, src.begin() + offset)) {
+					fprintf(stderr, "ERROR: sig::copy() failed\n");
+					return 1;
+				}
+			}
+		}
+	}
+
+#if !defined _WIN32
+	{
+		// the copies run into a page we can't access. They should copy
+		// exactly up to it
+		guarded_region const region;
+		std::size_t const page = region.page;
+		char* const map = region.map;
+		std::vector<char> data(1000, 'x');
+		std::error_code ec;
+		std::size_t const written = sig::copy_to_mapped(map + page - 77, data.data()
+			, data.size(), ec);
+		std::size_t const read = sig::copy(data.data(), map + page - 100
+			, data.size(), ec);
+		if (written != 77 || read != 100
+			|| ec != std::error_condition(sig::errors::segmentation)) {
+			fprintf(stderr, "ERROR: unexpected partial copy: %d %d\n"
+				, int(written), int(read));
+			return 1;
+		}
+
+		// populating the source fails up-front, but the copy still makes as
+		// much progress as it can
+		if (sig::populate(map, page, true)
+			|| sig::copy(data.data(), map + page - 100, data.size(), ec
+				, sig::populate_source | sig::populate_destination) != 100
+			|| !ec) {
+			fprintf(stderr, "ERROR: unexpected result from populated copy\n");
+			return 1;
+		}
+	}
+
+#if TRY_SIGNAL_COROUTINES
+	{
+		// both awaitable copies stop at the page we can't access, whether the
+		// copy runs inline or on the executor
+		guarded_region const region;
+		std::size_t const page = region.page;
+		char* const map = region.map;
+		std::vector<char> data(1000);
+		manual_executor ex;
+		sig::copy_result results[2];
+		await_copies(data.data(), map + page - 100, data.size(), ex, results);
+		bool const suspended = results[1].bytes == 0 && !results[1].error;
+		ex.run();
+		if (results[0].bytes != 100 || results[1].bytes != 50 || !suspended
+			|| results[0].error != std::error_condition(sig::errors::segmentation)
+			|| results[1].error != std::error_condition(sig::errors::segmentation)) {
+			fprintf(stderr, "ERROR: unexpected result from awaited copies\n");
+			return 1;
+		}
+	}
+#endif
+
+	{
+		// a scatter/gather copy reports the segment and offset of the first
+		// fault, in both lists
+		guarded_region const region;
+		std::size_t const page = region.page;
+		char* const map = region.map;
+		std::vector<char> data(1000, 'x');
+		char small[10];
+		iovec src[] = { { &data[0], 500 }, { &data[500], 0 }, { &data[500], 500 } };
+		iovec dst[] = { { small, sizeof(small) }, { map + page - 600, 1000 } };
+		sig::copyv_result const r = sig::copyv(dst, 2, src, 3);
+		if (r.bytes != 610 || r.error != std::error_condition(sig::errors::segmentation)
+			|| r.dst_segment != 1 || r.dst_offset != 600
+			|| r.src_segment != 2 || r.src_offset != 110) {
+			fprintf(stderr, "ERROR: unexpected result from copyv()\n");
+			return 1;
+		}
+	}
+
+	{
+		// a checksummed copy (or a hashed one) that faults covers exactly the
+		// bytes that were copied
+		guarded_region const region;
+		std::size_t const page = region.page;
+		char* const map = region.map;
+		std::memcpy(map + page - 9, "123456789", 9);
+		std::vector<char> data(1000);
+		std::uint32_t crc = 0;
+		std::error_code ec;
+		std::size_t const n = sig::copy_crc32c(data.data(), map + page - 9
+			, data.size(), crc, ec);
+		std::string hashed;
+		std::error_code hash_ec;
+		std::size_t const hash_n = sig::copy_hash(data.data(), map + page - 9
+			, data.size(), [&](char const* buf, std::size_t len) { hashed.append(buf, len); }
+			, hash_ec);
+		// a fault in update itself is reported, rather than retried forever
+		std::error_code update_ec;
+		char const volatile* const guard = map + page;
+		std::size_t const update_n = sig::copy_hash(data.data(), map, 9
+			, [&](char const*, std::size_t) { data[0] = *guard; }, update_ec);
+		if (n != 9 || crc != 0xe3069283 || ec != std::error_condition(sig::errors::segmentation)
+			|| hash_n != 9 || hashed != "123456789" || !hash_ec || update_n != 0
+			|| update_ec != std::error_condition(sig::errors::segmentation)
+			|| sig::crc32c(sig::crc32c(0, "1234", 4), "56789", 5) != 0xe3069283) {
+			fprintf(stderr, "ERROR: unexpected result from copy_crc32c()\n");
+			return 1;
+		}
+	}
+
+	{
+		// a scan stops at the first match, or at the first fault, with its
+		// exact offset
+		guarded_region const region;
+		std::size_t const page = region.page;
+		char* const map = region.map;
+		std::memset(map, 'x', page);
+		std::memcpy(map + page - 300, "record\n", 7);
+		std::vector<char> data(map + page - 1000, map + page);
+		data.resize(2000, 'y');
+		sig::search_result const newline = sig::find_byte(map, 2 * page, '\n');
+		sig::search_result const missing = sig::find_byte(map, 2 * page, 'y');
+		sig::search_result const pattern = sig::find(map, 2 * page, "record", 6);
+		sig::search_result const partial = sig::find(map, 2 * page, "xxy", 3);
+		sig::search_result const diff = sig::compare(map + page - 1000, data.data(), 2000);
+		if (newline.offset != page - 294 || newline.error
+			|| missing.offset != page || missing.error != std::error_condition(sig::errors::segmentation)
+			|| pattern.offset != page - 300 || pattern.error
+			|| partial.offset != page || !partial.error
+			|| diff.offset != 1000 || !diff.error) {
+			fprintf(stderr, "ERROR: unexpected result from protected scan\n");
+			return 1;
+		}
+	}
+
+	{
+		// a parallel copy reports the lowest fault, even if chunks after it
+		// were copied first
+		std::size_t const page = std::size_t(sysconf(_SC_PAGESIZE));
+		std::size_t const size = 8 * 1024 * 1024;
+		char* const map = static_cast<char*>(mmap(nullptr, size
+			, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		std::memset(map, 'x', size);
+		mprotect(map + size / 2 + page, page, PROT_NONE);
+		mprotect(map + size - page, page, PROT_NONE);
+		std::vector<char> data(size);
+		sig::worker_pool pool(3);
+		std::error_code ec;
+		std::size_t const n = sig::parallel_copy(data.data(), map + 100, size - 100
+			, pool, ec);
+		munmap(map, size);
+		if (n != size / 2 + page - 100
+			|| ec != std::error_condition(sig::errors::segmentation)
+			|| std::count(data.begin(), data.begin() + std::ptrdiff_t(n), 'x') != std::ptrdiff_t(n)) {
+			fprintf(stderr, "ERROR: unexpected result from parallel_copy(): %d\n", int(n));
+			return 1;
+		}
+	}
+
+	{
+		// a resolver can make an inaccessible page accessible, and have the
+		// access retried
+		std::size_t const page = std::size_t(sysconf(_SC_PAGESIZE));
+		char* const map = static_cast<char*>(mmap(nullptr, page, PROT_NONE
+			, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+#if TRY_SIGNAL_STATS
+		std::uint64_t const resolved_before = sig::stats_snapshot().resolved;
+#endif
+		int const handle = sig::register_resolver(map, page
+			, [](void* addr, int, void*) {
+				std::size_t const ps = std::size_t(sysconf(_SC_PAGESIZE));
+				void* page_start = reinterpret_cast<void*>(
+					reinterpret_cast<std::uintptr_t>(addr) & ~std::uintptr_t(ps - 1));
+				return mprotect(page_start, ps, PROT_READ | PROT_WRITE) == 0;
+			}, nullptr);
+		char volatile* p = map + 10;
+		*p = 42;
+		sig::unregister_resolver(handle);
+		bool const resolved = handle >= 0 && *p == 42;
+		munmap(map, page);
+		if (!resolved) {
+			fprintf(stderr, "ERROR: expected fault to be resolved\n");
+			return 1;
+		}
+#if TRY_SIGNAL_STATS
+		if (sig::stats_snapshot().resolved != resolved_before + 1) {
+			fprintf(stderr, "ERROR: expected the resolved fault to be counted\n");
+			return 1;
+		}
+#endif
+	}
+
+	{
+		// a fiber switching in its own protection context must not disturb
+		// the scope of the thread it runs on
+		sig::protection_context fiber;
+		bool inner = false;
+		std::error_code const ec = sig::try_signal_noexcept([&]{
+			{
+				sig::scoped_protection_context ctx(fiber);
+				inner = sig::try_signal_noexcept([&]{ dest[0] = *invalid_address; })
+					== std::error_condition(sig::errors::segmentation);
+			}
+			dest[0] = *invalid_address;
+		});
+		if (!inner || ec != std::error_condition(sig::errors::segmentation)) {
+			fprintf(stderr, "ERROR: unexpected result with protection_context\n");
+			return 1;
+		}
+	}
+
+	{
+		// with an alternate signal stack, a stack overflow is just another
+		// segmentation fault
+		bool caught = false;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, 64 * 1024);
+		pthread_t thread;
+		if (pthread_create(&thread, &attr, &overflow_thread, &caught) == 0)
+			pthread_join(thread, nullptr);
+		pthread_attr_destroy(&attr);
+		if (!caught) {
+			fprintf(stderr, "ERROR: expected stack overflow to be caught\n");
+			return 1;
+		}
+	}
+
+	{
+		std::vector<char> data(100000);
+		for (std::size_t i = 0; i < data.size(); ++i) data[i] = char(i * 3);
+
+		unlink("test_mapped_file");
+		sig::mapped_file f("test_mapped_file", sig::mapped_file::read_write);
+		std::error_code ec;
+		f.write(0, data.data(), data.size(), ec);
+		if (ec || f.size() != std::int64_t(data.size())) {
+			fprintf(stderr, "ERROR: mapped_file::write() failed: %s\n", ec.message().c_str());
+			return 1;
+		}
+
+		// reads are truncated at the end of the file
+		std::vector<char> read_back(data.size());
+		std::size_t const n = f.read(10, read_back.data(), read_back.size(), ec);
+		if (ec || n != data.size() - 10
+			|| !std::equal(data.begin() + 10, data.end(), read_back.begin())) {
+			fprintf(stderr, "ERROR: mapped_file::read() failed\n");
+			return 1;
+		}
+
+		// empty views don't call the function, and ranges that overflow are
+		// rejected
+		bool called = false;
+		ec = f.view(f.size(), 0, [&](char const*, std::size_t) { called = true; });
+		if (ec || called || f.read(1, read_back.data(), std::size_t(-1), ec) != 0
+			|| ec != std::errc::invalid_argument) {
+			fprintf(stderr, "ERROR: unexpected result from empty or overflowing range\n");
+			return 1;
+		}
+
+		// when the file is truncated behind our back, reads fail at the new
+		// end of the file (rounded up to a page boundary)
+		std::size_t const page = std::size_t(sysconf(_SC_PAGESIZE));
+		if (ftruncate(f.fd(), std::int64_t(page)) != 0) {
+			fprintf(stderr, "ERROR: ftruncate() failed\n");
+			return 1;
+		}
+		if (f.read(0, read_back.data(), 3 * page, ec) != page
+			|| ec != std::error_condition(sig::errors::bus)) {
+			fprintf(stderr, "ERROR: expected bus error from mapped_file::read()\n");
+			return 1;
+		}
+
+		// the second time, the error comes from the index of bad pages
+		if (f.read(page / 2, read_back.data(), 3 * page, ec) != page / 2
+			|| ec != std::error_condition(sig::errors::bus)) {
+			fprintf(stderr, "ERROR: expected cached bus error from mapped_file::read()\n");
+			return 1;
+		}
+
+		// resizing the file clears the index
+		f.resize(std::int64_t(2 * page), ec);
+		if (ec || f.read(0, read_back.data(), 3 * page, ec) != 2 * page || ec) {
+			fprintf(stderr, "ERROR: expected mapped_file::read() to succeed\n");
+			return 1;
+		}
+
+		// after enough faults, reads switch to pread(), and back again once
+		// they succeed
+		sig::mapped_file::fallback_policy policy;
+		policy.fault_threshold = 1;
+		policy.recovery_calls = 2;
+		f.set_fallback_policy(policy);
+		if (ftruncate(f.fd(), std::int64_t(page)) != 0) {
+			fprintf(stderr, "ERROR: ftruncate() failed\n");
+			return 1;
+		}
+		f.read(0, read_back.data(), 2 * page, ec);
+		if (!f.using_fallback()) {
+			fprintf(stderr, "ERROR: expected mapped_file to fall back to pread()\n");
+			return 1;
+		}
+		// pread() stops at the end of the truncated file with the same error
+		// as the mapping, and that doesn't count as a success. Once the file
+		// is restored, reads succeed and switch back to the mapping
+		if (f.read(0, read_back.data(), 2 * page, ec) != page
+			|| ec != std::error_condition(sig::errors::bus)
+			|| f.read(0, read_back.data(), page, ec) != page || ec
+			|| !f.using_fallback()) {
+			fprintf(stderr, "ERROR: unexpected result from pread() fallback\n");
+			return 1;
+		}
+		if (ftruncate(f.fd(), std::int64_t(2 * page)) != 0
+			|| f.read(0, read_back.data(), 2 * page, ec) != 2 * page || ec
+			|| f.using_fallback()) {
+			fprintf(stderr, "ERROR: expected mapped_file to switch back to the mapping\n");
+			return 1;
+		}
+
+		// the pages known to be bad are still avoided after switching back
+		if (f.read(0, read_back.data(), 2 * page, ec) != page
+			|| ec != std::error_condition(sig::errors::bus)) {
+			fprintf(stderr, "ERROR: expected bad pages to be kept after recovery\n");
+			return 1;
+		}
+
+		// faults that are further apart than the window don't add up
+		policy.fault_threshold = 2;
+		policy.fault_window = std::chrono::milliseconds(1);
+		f.set_fallback_policy(policy);
+		f.resize(std::int64_t(4 * page), ec);
+		if (ec || ftruncate(f.fd(), std::int64_t(page)) != 0) {
+			fprintf(stderr, "ERROR: ftruncate() failed\n");
+			return 1;
+		}
+		f.read(page, read_back.data(), page, ec);
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		f.read(2 * page, read_back.data(), page, ec);
+		if (ec != std::error_condition(sig::errors::bus) || f.using_fallback()) {
+			fprintf(stderr, "ERROR: expected faults to expire\n");
+			return 1;
+		}
+	}
+	unlink("test_mapped_file");
+
+	{
+		// the prefetch thread touches the pages ahead of a sequential reader.
+		// The pages it fails on are recorded as bad, and the reader gets the
+		// error without taking a fault itself
+		std::size_t const page = std::size_t(sysconf(_SC_PAGESIZE));
+		std::vector<char> data(256 * page, 'x');
+		unlink("test_mapped_file");
+		sig::mapped_file f("test_mapped_file"
+			, sig::mapped_file::read_write | sig::mapped_file::prefetch);
+		std::error_code ec;
+		f.write(0, data.data(), data.size(), ec);
+		if (ec || ftruncate(f.fd(), std::int64_t(128 * page)) != 0) {
+			fprintf(stderr, "ERROR: failed to set up prefetch test\n");
+			return 1;
+		}
+		for (std::size_t i = 0; i < 8; ++i)
+			f.read(std::int64_t(i * page), data.data(), page, ec);
+		for (int i = 0; i < 500 && f.prefetch_end() < f.size(); ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+		void const* const last_fault = sig::detail::last_fault().address;
+		std::size_t const n = f.read(std::int64_t(127 * page), data.data(), 2 * page, ec);
+		if (f.prefetch_end() != f.size() || n != page
+			|| ec != std::error_condition(sig::errors::bus)
+			|| sig::detail::last_fault().address != last_fault) {
+			fprintf(stderr, "ERROR: unexpected result from prefetching read\n");
+			return 1;
+		}
+	}
+	unlink("test_mapped_file");
+
+	{
+		// transparent huge pages don't change the granularity of faults. The
+		// file isn't on hugetlbfs, so a read past the end of the truncated
+		// file fails at the page boundary, even if it's in the middle of a
+		// huge page, and the page before it can still be read
+		std::size_t const page = std::size_t(sysconf(_SC_PAGESIZE));
+		std::vector<char> data(4 * 1024 * 1024, 'x');
+		unlink("test_mapped_file");
+		sig::mapped_file f("test_mapped_file"
+			, sig::mapped_file::read_write | sig::mapped_file::huge_pages);
+		std::error_code ec;
+		f.write(0, data.data(), data.size(), ec);
+		std::size_t const truncated = 2 * 1024 * 1024 + page;
+		if (ec || f.granularity() != page
+			|| ftruncate(f.fd(), std::int64_t(truncated)) != 0) {
+			fprintf(stderr, "ERROR: failed to set up huge page test\n");
+			return 1;
+		}
+		std::size_t const n = f.read(0, data.data(), data.size(), ec);
+		std::error_code last_ec;
+		std::size_t const last = f.read(2 * 1024 * 1024, data.data(), data.size(), last_ec);
+		if (n != truncated || ec != std::error_condition(sig::errors::bus)
+			|| last != page || last_ec != std::error_condition(sig::errors::bus)) {
+			fprintf(stderr, "ERROR: unexpected result from huge page read: %d %d\n"
+				, int(n), int(last));
+			return 1;
+		}
+	}
+	unlink("test_mapped_file");
+
+	{
+		// the file is grown (and space reserved) a chunk at a time, and
+		// truncated to what was appended when the writer is closed
+		std::vector<char> data(100000);
+		for (std::size_t i = 0; i < data.size(); ++i) data[i] = char(i * 5);
+
+		unlink("test_mapped_writer");
+		sig::mapped_writer::options opts;
+		opts.reserve_chunk = 1024 * 1024;
+		opts.flush_bytes = 150000;
+		{
+			sig::mapped_writer w("test_mapped_writer", opts);
+			std::error_code ec;
+			for (int i = 0; i < 3; ++i) {
+				if (w.append(data.data(), data.size(), ec) != data.size() || ec) {
+					fprintf(stderr, "ERROR: mapped_writer::append() failed: %s\n"
+						, ec.message().c_str());
+					return 1;
+				}
+			}
+			w.sync(ec);
+			if (ec || w.size() != 3 * std::int64_t(data.size())
+				|| w.file().size() < w.size()) {
+				fprintf(stderr, "ERROR: unexpected mapped_writer size\n");
+				return 1;
+			}
+		}
+
+		sig::mapped_file f("test_mapped_writer", sig::mapped_file::read_only);
+		std::vector<char> read_back(data.size());
+		std::error_code ec;
+		if (f.size() != 3 * std::int64_t(data.size())
+			|| f.read(2 * std::int64_t(data.size()), read_back.data(), read_back.size(), ec)
+				!= data.size()
+			|| read_back != data) {
+			fprintf(stderr, "ERROR: unexpected file written by mapped_writer\n");
+			return 1;
+		}
+	}
+	unlink("test_mapped_writer");
+#endif
+
+#if !defined _WIN32
+	{
+		// a scope only catches the signals it asks for. Others are caught by
+		// the closest enclosing scope that does. Integer division by zero
+		// doesn't trap on all architectures (e.g. not on ARM), so SIGFPE is
+		// raised explicitly
+		std::error_code inner;
+		std::error_code const outer = sig::try_signal_noexcept<sig::catch_fpe | sig::catch_segv>([&]{
+			inner = sig::try_signal_noexcept<sig::catch_fpe>([&]{ std::raise(SIGFPE); });
+			sig::try_signal_noexcept<sig::catch_fpe>([&]{ dest[0] = *invalid_address; });
+		});
+		if (inner != std::error_condition(sig::errors::arithmetic_exception)
+			|| outer != std::error_condition(sig::errors::segmentation)) {
+			fprintf(stderr, "ERROR: unexpected result with catch_fpe\n");
+			return 1;
+		}
+	}
+
+#if defined __i386__ || defined __x86_64__
+	{
+		// on x86, integer division by zero raises SIGFPE
+		int volatile dividend = 7;
+		int volatile zero = 0;
+		int volatile quotient = 0;
+		std::error_code const ec = sig::try_signal_noexcept<sig::catch_fpe>([&]{
+			quotient = dividend / zero;
+		});
+		if (ec != std::error_condition(sig::errors::arithmetic_exception)) {
+			fprintf(stderr, "ERROR: expected division by zero to be caught\n");
+			return 1;
+		}
+	}
+#endif
+#endif
+
+	{
+		// a fault in one element of a batch should only fail that element
+		char const* sources[] = { buf, nullptr, buf, nullptr, buf };
+		std::array<std::error_code, 5> status;
+		std::size_t const failed = sig::try_signal_batch(std::begin(sources)
+			, std::end(sources), status.data(), [&](char const* src) {
+			std::memcpy(dest, src, sizeof(buf));
+		});
+		if (failed != 2 || status[0] || !status[1] || status[2] || !status[3]
+			|| status[4] || status[1] != std::error_condition(sig::errors::segmentation)) {
+			fprintf(stderr, "ERROR: unexpected batch result\n");
+			return 1;
+		}
+	}
+
+#if TRY_SIGNAL_STATS && !defined _WIN32
+	{
+		// by now, we have caught plenty of faults, some of them in nested
+		// scopes
+		sig::stats const st = sig::stats_snapshot();
+		std::uint64_t faults = 0;
+		for (auto const& reasons : st.faults)
+			for (std::uint64_t const n : reasons) faults += n;
+		std::uint64_t caught = 0;
+		for (std::uint64_t const n : st.latency) caught += n;
+		if (st.calls < caught || caught < 5 || caught + st.resolved > faults
+			|| st.faults[SIGSEGV][SEGV_MAPERR] == 0 || st.resolved < 1
+			|| st.max_depth < 2) {
+			fprintf(stderr, "ERROR: unexpected stats\n");
+			return 1;
+		}
+	}
+#endif
+
 	try {
 		void* invalid_pointer = nullptr;
 		sig::try_signal([&]{
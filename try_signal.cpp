@@ -36,6 +36,19 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <csetjmp>
 #include <csignal>
 
+#if !defined _WIN32
+#include <pthread.h> // for pthread_sigmask
+#include <cstdint>
+#include <cerrno>
+#include <thread> // for yield
+#include <mutex>
+#include <vector>
+#include <algorithm> // for max
+#include <unistd.h> // for sysconf
+#include <sys/mman.h>
+#include <time.h> // for clock_gettime
+#endif
+
 #include "try_signal.hpp"
 
 #if !defined _WIN32
@@ -45,43 +58,503 @@ namespace sig {
 namespace detail {
 
 namespace {
-thread_local sigjmp_buf* jmpbuf = nullptr;
+#if !TRY_SIGNAL_HEADER_ONLY
+// in header-only mode, these are defined in try_signal_posix.hpp
+thread_local scoped_jmpbuf* innermost_scope = nullptr;
+
+// the signals the handler is known to be installed for. This is per-thread,
+// rather than global, to avoid having every call to try_signal() read a
+// cache line written by other threads
+thread_local unsigned installed = 0;
+
+scoped_jmpbuf*& current_scope() { return innermost_scope; }
+unsigned& installed_signals() { return installed; }
+#endif
+
+thread_local fault_info fault;
+
+#if TRY_SIGNAL_STATS
+// the counters of one thread. The atomics are only written by the thread
+// owning the block, and read by stats_snapshot(). Blocks are never freed. When
+// a thread exits, its block is released, and taken over by the next thread
+// that needs one. This way the counts of past threads are kept.
+struct thread_stats
+{
+	std::atomic<std::uint64_t> calls;
+	std::atomic<std::uint64_t> faults[stats::max_signal][stats::max_reason];
+	std::atomic<std::uint64_t> resolved;
+	std::atomic<std::uint64_t> max_depth;
+	std::atomic<std::uint64_t> latency[stats::latency_buckets];
+
+	// these are only accessed by the owning thread
+	std::int64_t depth;
+	std::uint64_t fault_time;
+
+	std::atomic<bool> in_use;
+	thread_stats* next;
+};
+
+// the list of all blocks. Blocks are only ever pushed to the front
+std::atomic<thread_stats*> all_stats(nullptr);
+
+// this is a plain pointer, so the signal handler can use it without running
+// any thread_local initialization
+thread_local thread_stats* stats_block = nullptr;
+
+// releases the block of a thread when it exits
+struct stats_release
+{
+	~stats_release()
+	{
+		if (stats_block != nullptr)
+			stats_block->in_use.store(false, std::memory_order_release);
+	}
+};
+
+thread_local stats_release release_stats;
+
+// there is only one writer to each counter, so it doesn't need an atomic
+// read-modify-write
+void increment(std::atomic<std::uint64_t>& c)
+{
+	c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
 }
 
-std::atomic_flag once = ATOMIC_FLAG_INIT;
+// clock_gettime() is async-signal-safe
+std::uint64_t now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return std::uint64_t(ts.tv_sec) * 1000000000 + std::uint64_t(ts.tv_nsec);
+}
 
-scoped_jmpbuf::scoped_jmpbuf(sigjmp_buf* ptr)
+thread_stats* acquire_stats()
 {
-	_previous_ptr = jmpbuf;
-	jmpbuf = ptr;
+	// make sure the block is released when this thread exits
+	static_cast<void>(&release_stats);
+
+	thread_stats* s = all_stats.load(std::memory_order_acquire);
+	for (; s != nullptr; s = s->next)
+	{
+		bool expected = false;
+		if (!s->in_use.load(std::memory_order_relaxed)
+			&& s->in_use.compare_exchange_strong(expected, true
+				, std::memory_order_acquire))
+			break;
+	}
+
+	if (s == nullptr)
+	{
+		// value-initialization zeroes the counters
+		s = new thread_stats();
+		s->in_use.store(true, std::memory_order_relaxed);
+		s->next = all_stats.load(std::memory_order_relaxed);
+		while (!all_stats.compare_exchange_weak(s->next, s
+			, std::memory_order_release, std::memory_order_relaxed));
+	}
+	s->depth = 0;
+	s->fault_time = 0;
+	stats_block = s;
+	return s;
+}
+
+void count_fault(int const signo, int const code)
+{
+	thread_stats* const s = stats_block;
+	if (s == nullptr) return;
+	int const reason = (code >= 0 && code < stats::max_reason)
+		? code : stats::max_reason - 1;
+	if (signo >= 0 && signo < stats::max_signal)
+		increment(s->faults[signo][reason]);
+	s->fault_time = now();
+}
+
+void count_resolved()
+{
+	thread_stats* const s = stats_block;
+	if (s == nullptr) return;
+	increment(s->resolved);
+	s->fault_time = 0;
+}
+
+// the scopes jumped over by the signal handler are never destructed
+void count_skipped_scopes(int const n)
+{
+	thread_stats* const s = stats_block;
+	if (s == nullptr) return;
+	s->depth -= n;
+}
+#endif
+
+// the fault resolvers are kept in a fixed size table, since the signal handler
+// can't take locks or allocate memory
+struct resolver_slot
+{
+	enum state_t { unused, busy, active };
+
+	// the other fields may only be accessed by the signal handler when state
+	// is active, and only be changed by the thread that moved it from free to
+	// busy
+	std::atomic<int> state;
+	std::uintptr_t begin;
+	std::uintptr_t end;
+	fault_resolver fun;
+	void* userdata;
+};
+
+resolver_slot resolvers[64];
+
+// the number of signal handlers currently looking at the table of resolvers
+std::atomic<int> resolving(0);
+
+bool resolve(int const signo, void* addr)
+{
+	std::uintptr_t const a = reinterpret_cast<std::uintptr_t>(addr);
+	bool resolved = false;
+	// this pairs with unregister_resolver(), which changes the state of a slot
+	// and then waits for resolving to drop to zero. Both need to be
+	// sequentially consistent
+	resolving.fetch_add(1, std::memory_order_seq_cst);
+	for (resolver_slot& r : resolvers)
+	{
+		if (r.state.load(std::memory_order_seq_cst) != resolver_slot::active) continue;
+		if (a < r.begin || a >= r.end) continue;
+		resolved = r.fun(addr, signo, r.userdata);
+		break;
+	}
+	resolving.fetch_sub(1, std::memory_order_release);
+	return resolved;
+}
+
+// the size of the alternate signal stacks, not counting the guard page
+std::size_t const alt_stack_size = 64 * 1024;
+
+std::size_t page_size()
+{
+	static std::size_t const size = std::size_t(sysconf(_SC_PAGESIZE));
+	return size;
+}
+
+// alternate signal stacks no longer used by any thread
+std::mutex alt_stack_mutex;
+std::vector<char*> alt_stack_pool;
+
+// the alternate signal stack of a thread, which is returned to the pool when
+// the thread exits
+struct alt_stack
+{
+	alt_stack() = default;
+	alt_stack(alt_stack const&) = delete;
+	alt_stack& operator=(alt_stack const&) = delete;
+
+	~alt_stack()
+	{
+		if (memory == nullptr) return;
+		stack_t st;
+		st.ss_sp = nullptr;
+		st.ss_size = 0;
+		st.ss_flags = SS_DISABLE;
+		sigaltstack(&st, nullptr);
+		std::lock_guard<std::mutex> l(alt_stack_mutex);
+		alt_stack_pool.push_back(memory);
+	}
+
+	// the start of the mapping, including the guard page
+	char* memory = nullptr;
+};
+
+thread_local alt_stack thread_alt_stack;
+
+// the signals corresponding to the catch_signals flags
+struct catchable_signal
+{
+	unsigned flag;
+	int signo;
+};
+
+catchable_signal const catchable_signals[] = {
+	{ catch_segv, SIGSEGV },
+	{ catch_bus, SIGBUS },
+	{ catch_fpe, SIGFPE },
+	{ catch_ill, SIGILL },
+};
+
+unsigned signal_flag(int const signo)
+{
+	for (catchable_signal const& c : catchable_signals)
+		if (c.signo == signo) return c.flag;
+	return 0;
+}
+
+// the signals the handler has been installed for, by any thread
+std::mutex install_mutex;
+std::atomic<unsigned> installed_handlers(0);
+}
+
+#if !TRY_SIGNAL_HEADER_ONLY
+scoped_jmpbuf::scoped_jmpbuf(sigjmp_buf* buf, unsigned const signals)
+	: _buf(buf), _signals(signals)
+{
+	if ((installed_signals() & signals) != signals)
+	{
+		setup_handler(signals);
+		installed_signals() |= signals;
+	}
+
+#if TRY_SIGNAL_STATS
+	enter_scope();
+#endif
+
+	_previous = current_scope();
+	current_scope() = this;
 	std::atomic_signal_fence(std::memory_order_release);
 }
 
-scoped_jmpbuf::~scoped_jmpbuf() { jmpbuf = _previous_ptr; }
+scoped_jmpbuf::~scoped_jmpbuf()
+{
+	current_scope() = _previous;
+#if TRY_SIGNAL_STATS
+	leave_scope();
+#endif
+}
+#endif
 
-void handler(int const signo, siginfo_t*, void*)
+#if TRY_SIGNAL_STATS
+void enter_scope()
+{
+	thread_stats* s = stats_block;
+	if (s == nullptr) s = acquire_stats();
+	increment(s->calls);
+	++s->depth;
+	if (s->depth > 0 && std::uint64_t(s->depth) > s->max_depth.load(std::memory_order_relaxed))
+		s->max_depth.store(std::uint64_t(s->depth), std::memory_order_relaxed);
+}
+
+void leave_scope() { --stats_block->depth; }
+#endif
+
+fault_info const& last_fault() { return fault; }
+
+#if TRY_SIGNAL_STATS
+void caught()
+{
+	thread_stats* const s = stats_block;
+	if (s == nullptr || s->fault_time == 0) return;
+	std::uint64_t elapsed = now() - s->fault_time;
+	s->fault_time = 0;
+	int bucket = 0;
+	while (elapsed > 1 && bucket < stats::latency_buckets - 1)
+	{
+		elapsed >>= 1;
+		++bucket;
+	}
+	increment(s->latency[bucket]);
+}
+#endif
+
+void handler(int const signo, siginfo_t* si, void* ctx)
 {
 	std::atomic_signal_fence(std::memory_order_acquire);
-	if (jmpbuf)
-		siglongjmp(*jmpbuf, signo);
 
-	// this signal was not caused within the scope of a try_signal object,
+#if TRY_SIGNAL_STATS
+	count_fault(signo, si->si_code);
+#endif
+
+	// if a resolver fixed the fault, returning retries the instruction that
+	// caused it. Resolvers are only registered for address ranges, which only
+	// makes sense for memory access faults
+	if ((signo == SIGSEGV || signo == SIGBUS) && resolve(signo, si->si_addr))
+	{
+#if TRY_SIGNAL_STATS
+		count_resolved();
+#endif
+		return;
+	}
+
+	// find the innermost scope catching this signal
+	unsigned const flag = signal_flag(signo);
+	scoped_jmpbuf* scope = current_scope();
+	int skipped = 0;
+	while (scope != nullptr && (scope->_signals & flag) == 0)
+	{
+		scope = scope->_previous;
+		++skipped;
+	}
+
+	if (scope != nullptr)
+	{
+		fault.address = si->si_addr;
+		fault.reason = si->si_code;
+		fault.extent = 0;
+#if defined BUS_MCEERR_AR && defined BUS_MCEERR_AO
+		if (signo == SIGBUS && (si->si_code == BUS_MCEERR_AR || si->si_code == BUS_MCEERR_AO))
+			fault.extent = std::size_t(1) << si->si_addr_lsb;
+#endif
+
+		// the scopes we jump over are abandoned, without being destructed.
+		// The one we jump to becomes the innermost one again
+		current_scope() = scope;
+#if TRY_SIGNAL_STATS
+		count_skipped_scopes(skipped);
+#else
+		static_cast<void>(skipped);
+#endif
+
+		// try_signal() does not save the signal mask in its jmpbuf. The
+		// kernel blocks signo while we're in here, so restore the mask of the
+		// interrupted context before we jump back, or the next fault would
+		// kill the process
+		ucontext_t const* uc = static_cast<ucontext_t const*>(ctx);
+		pthread_sigmask(SIG_SETMASK, &uc->uc_sigmask, nullptr);
+		siglongjmp(*scope->_buf, signo);
+	}
+
+	// this signal was not raised within a try_signal() scope catching it,
 	// invoke the default handler
 	signal(signo, SIG_DFL);
 	raise(signo);
 }
 
-void setup_handler()
+void setup_handler(unsigned const signals)
 {
+	if ((installed_handlers.load(std::memory_order_acquire) & signals) == signals)
+		return;
+
+	// any other thread getting here at the same time blocks until the
+	// handlers have been installed
+	std::lock_guard<std::mutex> l(install_mutex);
+	unsigned const installed = installed_handlers.load(std::memory_order_relaxed);
 	struct sigaction sa;
 	sa.sa_sigaction = &sig::detail::handler;
 	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = SA_SIGINFO;
-	sigaction(SIGSEGV, &sa, nullptr);
-	sigaction(SIGBUS, &sa, nullptr);
+	// SA_ONSTACK only has an effect on threads that have an alternate signal
+	// stack, see use_alt_stack()
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	for (catchable_signal const& c : catchable_signals)
+	{
+		if ((signals & c.flag) == 0 || (installed & c.flag) != 0) continue;
+		sigaction(c.signo, &sa, nullptr);
+	}
+	installed_handlers.store(installed | signals, std::memory_order_release);
 }
 
 } // detail namespace
+
+stats stats_snapshot()
+{
+	stats ret;
+#if TRY_SIGNAL_STATS
+	for (detail::thread_stats const* s = detail::all_stats.load(std::memory_order_acquire)
+		; s != nullptr; s = s->next)
+	{
+		ret.calls += s->calls.load(std::memory_order_relaxed);
+		for (int i = 0; i < stats::max_signal; ++i)
+			for (int j = 0; j < stats::max_reason; ++j)
+				ret.faults[i][j] += s->faults[i][j].load(std::memory_order_relaxed);
+		ret.resolved += s->resolved.load(std::memory_order_relaxed);
+		ret.max_depth = std::max(ret.max_depth, s->max_depth.load(std::memory_order_relaxed));
+		for (int i = 0; i < stats::latency_buckets; ++i)
+			ret.latency[i] += s->latency[i].load(std::memory_order_relaxed);
+	}
+#endif
+	return ret;
+}
+
+void protection_context::swap_in()
+{
+	_thread = detail::current_scope();
+	detail::current_scope() = _fiber;
+	std::atomic_signal_fence(std::memory_order_release);
+}
+
+void protection_context::swap_out()
+{
+	_fiber = detail::current_scope();
+	detail::current_scope() = _thread;
+	std::atomic_signal_fence(std::memory_order_release);
+}
+
+std::error_code use_alt_stack()
+{
+	detail::alt_stack& s = detail::thread_alt_stack;
+	if (s.memory != nullptr) return std::error_code();
+
+	std::size_t const guard = detail::page_size();
+	char* memory = nullptr;
+	{
+		std::lock_guard<std::mutex> l(detail::alt_stack_mutex);
+		if (!detail::alt_stack_pool.empty())
+		{
+			memory = detail::alt_stack_pool.back();
+			detail::alt_stack_pool.pop_back();
+		}
+	}
+
+	if (memory == nullptr)
+	{
+		void* const ptr = mmap(nullptr, guard + detail::alt_stack_size
+			, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			return std::error_code(errno, std::system_category());
+		memory = static_cast<char*>(ptr);
+		// the stack grows down, towards the guard page. If the signal handler
+		// overflows its stack, it crashes rather than corrupting memory
+		mprotect(memory, guard, PROT_NONE);
+	}
+
+	stack_t st;
+	st.ss_sp = memory + guard;
+	st.ss_size = detail::alt_stack_size;
+	st.ss_flags = 0;
+	if (sigaltstack(&st, nullptr) != 0)
+	{
+		std::error_code const ec(errno, std::system_category());
+		std::lock_guard<std::mutex> l(detail::alt_stack_mutex);
+		detail::alt_stack_pool.push_back(memory);
+		return ec;
+	}
+	s.memory = memory;
+	detail::setup_handler();
+	return std::error_code();
+}
+
+int register_resolver(void const* addr, std::size_t const len
+	, fault_resolver const r, void* userdata)
+{
+	detail::setup_handler();
+
+	int handle = 0;
+	for (detail::resolver_slot& slot : detail::resolvers)
+	{
+		int expected = detail::resolver_slot::unused;
+		if (slot.state.compare_exchange_strong(expected, detail::resolver_slot::busy))
+		{
+			slot.begin = reinterpret_cast<std::uintptr_t>(addr);
+			slot.end = slot.begin + len;
+			slot.fun = r;
+			slot.userdata = userdata;
+			slot.state.store(detail::resolver_slot::active, std::memory_order_release);
+			return handle;
+		}
+		++handle;
+	}
+	return -1;
+}
+
+void unregister_resolver(int const handle)
+{
+	if (handle < 0 || handle >= int(sizeof(detail::resolvers) / sizeof(detail::resolvers[0])))
+		return;
+
+	detail::resolver_slot& slot = detail::resolvers[handle];
+	slot.state.store(detail::resolver_slot::busy, std::memory_order_seq_cst);
+	// a signal handler may have picked up the resolver before we changed its
+	// state. Wait for it to finish before the slot can be reused
+	while (detail::resolving.load(std::memory_order_seq_cst) != 0)
+		std::this_thread::yield();
+	slot.state.store(detail::resolver_slot::unused, std::memory_order_release);
+}
+
 } // sig namespace
 
 #elif __GNUC__
@@ -95,27 +568,42 @@ void setup_handler()
 namespace sig {
 namespace detail {
 
-thread_local jmp_buf* jmpbuf = nullptr;
+namespace {
+thread_local scoped_handler* innermost_scope = nullptr;
+}
 
 long CALLBACK handler(EXCEPTION_POINTERS* pointers)
 {
 	std::atomic_signal_fence(std::memory_order_acquire);
-	if (jmpbuf)
-		longjmp(*jmpbuf, pointers->ExceptionRecord->ExceptionCode);
+
+	// find the innermost scope catching this exception
+	unsigned const flag = exception_flag(int(pointers->ExceptionRecord->ExceptionCode));
+	scoped_handler* scope = innermost_scope;
+	while (scope != nullptr && (scope->_signals & flag) == 0)
+		scope = scope->_previous;
+
+	if (scope != nullptr)
+	{
+		record_fault(pointers->ExceptionRecord);
+		// the scopes we jump over are abandoned, without being destructed
+		innermost_scope = scope;
+		longjmp(*scope->_buf, pointers->ExceptionRecord->ExceptionCode);
+	}
 	return EXCEPTION_CONTINUE_SEARCH;
 }
 
-scoped_handler::scoped_handler(jmp_buf* ptr)
+scoped_handler::scoped_handler(jmp_buf* buf, unsigned const signals)
+	: _buf(buf), _signals(signals)
 {
-	_previous_ptr = jmpbuf;
-	jmpbuf = ptr;
+	_previous = innermost_scope;
+	innermost_scope = this;
 	std::atomic_signal_fence(std::memory_order_release);
 	_handle = AddVectoredExceptionHandler(1, sig::detail::handler);
 }
 scoped_handler::~scoped_handler()
 {
 	RemoveVectoredExceptionHandler(_handle);
-	jmpbuf = _previous_ptr;
+	innermost_scope = _previous;
 }
 
 } // detail namespace
@@ -130,15 +618,87 @@ namespace sig {
 namespace detail {
 
 	// these are the kinds of SEH exceptions we'll translate into C++ exceptions
-	bool catch_error(int const code)
+	bool catch_error(int const code, unsigned const signals)
 	{
-		return code == EXCEPTION_IN_PAGE_ERROR
-			|| code == EXCEPTION_ACCESS_VIOLATION
-			|| code == EXCEPTION_ARRAY_BOUNDS_EXCEEDED;
+		return (exception_flag(code) & signals) != 0;
+	}
+
+	bool catch_error(int const code, unsigned const signals
+		, EXCEPTION_POINTERS* pointers)
+	{
+		if (!catch_error(code, signals)) return false;
+		record_fault(pointers->ExceptionRecord);
+		return true;
 	}
 } // detail namespace
 } // namespace sig
 
 #endif // _WIN32
 
+#ifdef _WIN32
+
+namespace sig {
+namespace detail {
+
+namespace {
+thread_local fault_info fault;
+}
+
+fault_info const& last_fault() { return fault; }
+
+unsigned exception_flag(int const code)
+{
+	switch (code)
+	{
+		case EXCEPTION_ACCESS_VIOLATION:
+		case EXCEPTION_ARRAY_BOUNDS_EXCEEDED:
+			return catch_segv;
+		case EXCEPTION_IN_PAGE_ERROR:
+			return catch_bus;
+		case EXCEPTION_FLT_DENORMAL_OPERAND:
+		case EXCEPTION_FLT_DIVIDE_BY_ZERO:
+		case EXCEPTION_FLT_INEXACT_RESULT:
+		case EXCEPTION_FLT_INVALID_OPERATION:
+		case EXCEPTION_FLT_OVERFLOW:
+		case EXCEPTION_FLT_UNDERFLOW:
+		case EXCEPTION_FLT_STACK_CHECK:
+		case EXCEPTION_INT_DIVIDE_BY_ZERO:
+		case EXCEPTION_INT_OVERFLOW:
+			return catch_fpe;
+		case EXCEPTION_ILLEGAL_INSTRUCTION:
+		case EXCEPTION_PRIV_INSTRUCTION:
+			return catch_ill;
+		default:
+			return 0;
+	}
+}
+
+void record_fault(EXCEPTION_RECORD const* rec)
+{
+	// access violations and in-page errors carry the kind of access and the
+	// address that was accessed
+	if ((rec->ExceptionCode == EXCEPTION_ACCESS_VIOLATION
+		|| rec->ExceptionCode == EXCEPTION_IN_PAGE_ERROR)
+		&& rec->NumberParameters >= 2)
+	{
+		fault.reason = static_cast<int>(rec->ExceptionInformation[0]);
+		fault.address = reinterpret_cast<void*>(rec->ExceptionInformation[1]);
+	}
+	else
+	{
+		fault.reason = 0;
+		fault.address = nullptr;
+	}
+	fault.extent = 0;
+}
+
+} // detail namespace
+
+// the counters are not collected on windows
+stats stats_snapshot() { return stats(); }
+
+} // sig namespace
+
+#endif // _WIN32
+
 
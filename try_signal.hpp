@@ -44,6 +44,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "try_signal_msvc.hpp"
 #endif
 
+#include "stats.hpp"
 
 #endif // TRY_SIGNAL_HPP_INCLUDED
 
@@ -34,8 +34,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TRY_SIGNAL_MINGW_HPP_INCLUDED
 
 #include "signal_error_code.hpp"
+#include "result.hpp"
 
 #include <setjmp.h> // for jmp_buf
+#include <cstddef> // for size_t
 
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
@@ -45,33 +47,122 @@ POSSIBILITY OF SUCH DAMAGE.
 namespace sig {
 namespace detail {
 
+long CALLBACK handler(EXCEPTION_POINTERS* pointers);
+
+// the catch_signals flag corresponding to a structured exception code, or 0
+unsigned exception_flag(int code);
+
+// pushes this scope as the innermost one for this thread. When a structured
+// exception is raised, the handler walks the chain of scopes and jumps to the
+// innermost one that catches it
 struct scoped_handler
 {
-	scoped_handler(jmp_buf* ptr);
+	scoped_handler(jmp_buf* buf, unsigned signals);
 	~scoped_handler();
 	scoped_handler(scoped_handler const&) = delete;
 	scoped_handler& operator=(scoped_handler const&) = delete;
 private:
+	friend long CALLBACK handler(EXCEPTION_POINTERS* pointers);
 	void* _handle;
-	jmp_buf* _previous_ptr;
+	jmp_buf* _buf;
+	unsigned _signals;
+	scoped_handler* _previous;
 };
 
+// records the address and kind of access of a fault, for last_fault()
+void record_fault(EXCEPTION_RECORD const* rec);
+
+// the details of the last structured exception caught by the calling thread
+fault_info const& last_fault();
+
 } // detail namespace
 
-template <typename Fun>
+// calls f(). If one of the structured exceptions selected by Signals (a
+// combination of catch_signals) is raised while it runs, it's thrown as a
+// fault_error
+template <unsigned Signals = catch_default, typename Fun>
 void try_signal(Fun&& f)
 {
 	jmp_buf buf;
-	int const code = setjmp(buf);
 	// set the thread local jmpbuf pointer, and make sure it's cleared when we
-	// leave the scope
-	sig::detail::scoped_handler scope(&buf);
+	// leave the scope. It must be in place before setjmp(), so that a
+	// longjmp() back here doesn't construct (and install) it a second time
+	sig::detail::scoped_handler scope(&buf, Signals);
+	int const code = setjmp(buf);
 	if (code != 0)
-		throw std::system_error(std::error_code(code, seh_category()));
+		throw sig::fault_error(std::error_code(code, seh_category())
+			, sig::detail::last_fault());
 
 	f();
 }
 
+// like try_signal(), but instead of throwing, a caught structured exception is
+// returned as an error code
+template <unsigned Signals = catch_default, typename Fun>
+std::error_code try_signal_noexcept(Fun&& f)
+{
+	jmp_buf buf;
+	sig::detail::scoped_handler scope(&buf, Signals);
+	int const code = setjmp(buf);
+	if (code != 0)
+		return std::error_code(code, seh_category());
+
+	f();
+	return std::error_code();
+}
+
+// like try_signal_noexcept(), but also returns the value returned by f. The
+// result holds either that value or the error of a caught structured exception
+template <unsigned Signals = catch_default, typename Fun>
+sig::detail::result_type<Fun> try_signal_result(Fun&& f)
+{
+	sig::detail::result_type<Fun> ret{sig::in_error, std::error_code()};
+	jmp_buf buf;
+	sig::detail::scoped_handler scope(&buf, Signals);
+	int const code = setjmp(buf);
+	if (code != 0)
+		return sig::detail::result_type<Fun>{sig::in_error, std::error_code(code, seh_category())};
+
+	sig::detail::call_into(ret, f);
+	return ret;
+}
+
+// calls f(first[i]) for each element in the random access range [first, last)
+// under a single protection scope. If a structured exception is raised for an
+// element, its entry in status is set to the error and the batch resumes at
+// the next element. status must point to (last - first) error codes. Returns
+// the number of elements that failed
+template <unsigned Signals = catch_default, typename It, typename Fun>
+std::size_t try_signal_batch(It first, It last, std::error_code* status, Fun&& f)
+{
+	std::size_t const n = static_cast<std::size_t>(last - first);
+
+	// these are modified after setjmp() and read after returning from it a
+	// second time, so they must not be cached in registers
+	std::size_t volatile i = 0;
+	std::size_t volatile failed = 0;
+
+	jmp_buf buf;
+	// the handler must be installed before setjmp(), since we may return from
+	// it more than once
+	sig::detail::scoped_handler scope(&buf, Signals);
+	int const code = setjmp(buf);
+	if (code != 0)
+	{
+		status[i] = std::error_code(code, seh_category());
+		failed = failed + 1;
+		i = i + 1;
+	}
+
+	while (i < n)
+	{
+		f(first[i]);
+		status[i] = std::error_code();
+		i = i + 1;
+	}
+	return failed;
+}
+
 } // sig namespace
 
 #endif
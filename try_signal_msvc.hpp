@@ -34,25 +34,115 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TRY_SIGNAL_MSVC_HPP_INCLUDED
 
 #include "signal_error_code.hpp"
+#include "result.hpp"
+#include <cstddef> // for size_t
 
 namespace sig {
 namespace detail {
 
-bool catch_error(int const code);
+// the catch_signals flag corresponding to a structured exception code, or 0
+unsigned exception_flag(int code);
+
+// returns true if the structured exception code is one of the signals (a
+// combination of catch_signals)
+bool catch_error(int const code, unsigned signals);
+
+// like catch_error(code, signals), but also records the details of the fault,
+// for last_fault()
+bool catch_error(int const code, unsigned signals, EXCEPTION_POINTERS* pointers);
+
+// records the address and kind of access of a fault, for last_fault()
+void record_fault(EXCEPTION_RECORD const* rec);
+
+// the details of the last structured exception caught by the calling thread
+fault_info const& last_fault();
+
+// calls f(), and returns the code of the structured exception it raised, or 0.
+// This is a separate function since __try may not be used in functions that
+// need to unwind objects
+template <unsigned Signals, typename Fun>
+int try_seh(Fun& f)
+{
+	__try
+	{
+		f();
+	}
+	__except (detail::catch_error(GetExceptionCode(), Signals, GetExceptionInformation()))
+	{
+		return GetExceptionCode();
+	}
+	return 0;
+}
 
 } // detail namespace
 
-template <typename Fun>
+// calls f(). If one of the structured exceptions selected by Signals (a
+// combination of catch_signals) is raised while it runs, it's thrown as a
+// fault_error
+template <unsigned Signals = catch_default, typename Fun>
 void try_signal(Fun&& f)
 {
 	__try
 	{
 		f();
 	}
-	__except (detail::catch_error(GetExceptionCode()))
+	__except (detail::catch_error(GetExceptionCode(), Signals, GetExceptionInformation()))
+	{
+		throw fault_error(std::error_code(GetExceptionCode(), seh_category())
+			, detail::last_fault());
+	}
+}
+
+// like try_signal(), but instead of throwing, a caught structured exception is
+// returned as an error code
+template <unsigned Signals = catch_default, typename Fun>
+std::error_code try_signal_noexcept(Fun&& f)
+{
+	int const code = detail::try_seh<Signals>(f);
+	if (code != 0)
+		return std::error_code(code, seh_category());
+	return std::error_code();
+}
+
+// like try_signal_noexcept(), but also returns the value returned by f. The
+// result holds either that value or the error of a caught structured exception
+template <unsigned Signals = catch_default, typename Fun>
+detail::result_type<Fun> try_signal_result(Fun&& f)
+{
+	detail::result_type<Fun> ret{sig::in_error, std::error_code()};
+	auto call = [&]{ detail::call_into(ret, f); };
+	int const code = detail::try_seh<Signals>(call);
+	if (code != 0)
+		return detail::result_type<Fun>{sig::in_error, std::error_code(code, seh_category())};
+	return ret;
+}
+
+// calls f(first[i]) for each element in the random access range [first, last).
+// If a structured exception is raised for an element, its entry in status is
+// set to the error and the batch resumes at the next element. status must
+// point to (last - first) error codes. Returns the number of elements that
+// failed
+template <unsigned Signals = catch_default, typename It, typename Fun>
+std::size_t try_signal_batch(It first, It last, std::error_code* status, Fun&& f)
+{
+	std::size_t const n = static_cast<std::size_t>(last - first);
+	std::size_t failed = 0;
+	for (std::size_t i = 0; i < n; ++i)
 	{
-		throw std::system_error(std::error_code(GetExceptionCode(), seh_category()));
+		// SEH is table based, entering a __try block is free, so there's
+		// nothing to gain from sharing one across the batch
+		__try
+		{
+			f(first[i]);
+			status[i] = std::error_code();
+		}
+		__except (detail::catch_error(GetExceptionCode(), Signals))
+		{
+			status[i] = std::error_code(GetExceptionCode(), seh_category());
+			++failed;
+		}
 	}
+	return failed;
 }
 
 } // sig namespace
@@ -34,46 +34,283 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TRY_SIGNAL_POSIX_HPP_INCLUDED
 
 #include "signal_error_code.hpp"
+#include "result.hpp"
 #include <setjmp.h> // for sigjmp_buf
-#include <atomic>
+#include <cstddef> // for size_t
+
+#if TRY_SIGNAL_HEADER_ONLY
+#include <atomic> // for atomic_signal_fence
+#endif
+
+// with TRY_SIGNAL_HEADER_ONLY, the thread locals use the initial-exec TLS
+// model, which makes them a single load relative to the thread pointer, even in
+// a shared library. It requires the library to be loaded at program startup
+// (rather than by dlopen())
+#if TRY_SIGNAL_HEADER_ONLY && defined __GNUC__
+#define TRY_SIGNAL_TLS_MODEL __attribute__((tls_model("initial-exec")))
+#else
+#define TRY_SIGNAL_TLS_MODEL
+#endif
 
 namespace sig {
 
 namespace detail {
 
-extern std::atomic_flag once;
+void handler(int const signo, siginfo_t* si, void*);
+
+// installs the signal handler for the signals in the set (a combination of
+// catch_signals), unless it's already installed
+void setup_handler(unsigned signals = catch_default);
+
+#if TRY_SIGNAL_STATS
+// count the protection scopes entered and left by the calling thread
+void enter_scope();
+void leave_scope();
+#endif
+
+struct scoped_jmpbuf;
+
+#if TRY_SIGNAL_HEADER_ONLY
+// the innermost scope of the calling thread. These are inline functions, so
+// that every translation unit (and the signal handler) refers to the same
+// variables, while try_signal() can access them without a function call
+inline scoped_jmpbuf*& current_scope()
+{
+	static thread_local scoped_jmpbuf* scope TRY_SIGNAL_TLS_MODEL = nullptr;
+	return scope;
+}
+
+// the signals the handler is known to be installed for. This is per-thread,
+// rather than global, to avoid having every call to try_signal() read a
+// cache line written by other threads
+inline unsigned& installed_signals()
+{
+	static thread_local unsigned installed TRY_SIGNAL_TLS_MODEL = 0;
+	return installed;
+}
+#endif
 
+// installs the signal handler for signals (if it isn't already) and pushes
+// this scope as the innermost one for this thread. When a signal is raised,
+// the handler walks the chain of scopes and jumps to the innermost one that
+// catches it
 struct scoped_jmpbuf
 {
-	explicit scoped_jmpbuf(sigjmp_buf* ptr);
+#if TRY_SIGNAL_HEADER_ONLY
+	scoped_jmpbuf(sigjmp_buf* buf, unsigned const signals)
+		: _buf(buf), _signals(signals)
+	{
+		if ((installed_signals() & signals) != signals)
+		{
+			setup_handler(signals);
+			installed_signals() |= signals;
+		}
+#if TRY_SIGNAL_STATS
+		enter_scope();
+#endif
+		_previous = current_scope();
+		current_scope() = this;
+		std::atomic_signal_fence(std::memory_order_release);
+	}
+
+	~scoped_jmpbuf()
+	{
+		current_scope() = _previous;
+#if TRY_SIGNAL_STATS
+		leave_scope();
+#endif
+	}
+#else
+	scoped_jmpbuf(sigjmp_buf* buf, unsigned signals);
 	~scoped_jmpbuf();
+#endif
 	scoped_jmpbuf(scoped_jmpbuf const&) = delete;
 	scoped_jmpbuf& operator=(scoped_jmpbuf const&) = delete;
 private:
-	sigjmp_buf* _previous_ptr;
+	friend void handler(int const signo, siginfo_t* si, void*);
+	sigjmp_buf* _buf;
+	unsigned _signals;
+	scoped_jmpbuf* _previous;
 };
 
-void handler(int const signo, siginfo_t* si, void*);
-void setup_handler();
+// the details of the last signal caught by the calling thread
+fault_info const& last_fault();
+
+// called by try_signal() when it has caught a signal, to record how long it
+// took since the signal handler was invoked
+#if TRY_SIGNAL_STATS
+void caught();
+#else
+inline void caught() {}
+#endif
 
 } // detail namespace
 
-template <typename Fun>
+// a fault resolver is called from the signal handler, for faults in the
+// address range it was registered for. If it returns true, the fault is
+// considered fixed, and the faulting instruction is retried. If it returns
+// false, the fault is handled as usual (i.e. caught by try_signal(), or
+// fatal). addr is the address that faulted.
+//
+// Resolvers run in signal handler context. They may only call async-signal-safe
+// functions (such as mmap(), mprotect() and memcpy()) and must not fault
+// themselves.
+using fault_resolver = bool (*)(void* addr, int signo, void* userdata);
+
+// registers a resolver for faults in the range [addr, addr + len). It applies
+// to faults from any thread, inside or outside of try_signal(). Returns a
+// handle to pass to unregister_resolver(), or -1 if there are too many
+// resolvers registered already
+int register_resolver(void const* addr, std::size_t len, fault_resolver r
+	, void* userdata);
+
+// removes a resolver. Once this returns, the resolver is no longer running,
+// and won't be called again
+void unregister_resolver(int handle);
+
+// the chain of try_signal() scopes of a fiber (a user-space thread with its
+// own stack). A scheduler that may resume a fiber on a different thread than
+// the one it was suspended on swaps the fiber's context in when resuming it,
+// and out when suspending it. That way, the try_signal() scopes of the fiber
+// follow it between threads, rather than lingering on the thread it left.
+//
+// C++20 coroutines don't need this. They can't suspend inside the function
+// object passed to try_signal(), since it isn't part of the coroutine.
+//
+// POSIX only. There's no windows equivalent.
+struct protection_context
+{
+	protection_context() = default;
+	protection_context(protection_context const&) = delete;
+	protection_context& operator=(protection_context const&) = delete;
+
+	// installs the fiber's scopes on the calling thread, saving the thread's
+	// own
+	void swap_in();
+
+	// saves the fiber's scopes, and restores the ones of the thread
+	void swap_out();
+
+private:
+	detail::scoped_jmpbuf* _fiber = nullptr;
+	detail::scoped_jmpbuf* _thread = nullptr;
+};
+
+// swaps a protection_context in for the lifetime of this object
+struct scoped_protection_context
+{
+	explicit scoped_protection_context(protection_context& ctx) : _ctx(ctx)
+	{ _ctx.swap_in(); }
+	~scoped_protection_context() { _ctx.swap_out(); }
+	scoped_protection_context(scoped_protection_context const&) = delete;
+	scoped_protection_context& operator=(scoped_protection_context const&) = delete;
+private:
+	protection_context& _ctx;
+};
+
+// gives the calling thread an alternate stack to run the signal handler on
+// (unless it already has one). Without it, a stack overflow inside
+// try_signal() kills the process, since there's no stack left for the handler
+// to run on. With it, the overflow is reported as a segmentation fault, like
+// any other. The stacks are kept in a pool. A thread's stack is returned to it
+// when the thread exits, and reused by the next thread asking for one.
+std::error_code use_alt_stack();
+
+// calls f(). If one of the signals in Signals (a combination of catch_signals)
+// is raised while it runs, it's thrown as a fault_error
+template <unsigned Signals = catch_default, typename Fun>
 void try_signal(Fun&& f)
 {
-	if (sig::detail::once.test_and_set() == false) {
-		sig::detail::setup_handler();
+	sigjmp_buf buf;
+	// push this scope for the thread, and make sure it's popped when we leave
+	// it. This must happen before sigsetjmp(), since we may return from it a
+	// second time, via the signal handler
+	sig::detail::scoped_jmpbuf scope(&buf, Signals);
+	// the signal mask is not saved here, since that would cost a system call
+	// on every call. Instead, the signal handler restores the mask of the
+	// faulting context before jumping back
+	int const sig = sigsetjmp(buf, 0);
+	if (sig != 0)
+	{
+		sig::detail::caught();
+		throw sig::fault_error(static_cast<sig::errors::error_code_enum>(sig)
+			, sig::detail::last_fault());
 	}
 
+	f();
+}
+
+// like try_signal(), but instead of throwing, a caught signal is returned as
+// an error code
+template <unsigned Signals = catch_default, typename Fun>
+std::error_code try_signal_noexcept(Fun&& f)
+{
 	sigjmp_buf buf;
-	int const sig = sigsetjmp(buf, 1);
-	// set the thread local jmpbuf pointer, and make sure it's cleared when we
-	// leave the scope
-	sig::detail::scoped_jmpbuf scope(&buf);
+	sig::detail::scoped_jmpbuf scope(&buf, Signals);
+	int const sig = sigsetjmp(buf, 0);
 	if (sig != 0)
-		throw std::system_error(static_cast<sig::errors::error_code_enum>(sig));
+	{
+		sig::detail::caught();
+		return static_cast<sig::errors::error_code_enum>(sig);
+	}
 
 	f();
+	return std::error_code();
+}
+
+// like try_signal_noexcept(), but also returns the value returned by f. The
+// result holds either that value or the error of a caught signal
+template <unsigned Signals = catch_default, typename Fun>
+sig::detail::result_type<Fun> try_signal_result(Fun&& f)
+{
+	sig::detail::result_type<Fun> ret{sig::in_error, std::error_code()};
+	sigjmp_buf buf;
+	sig::detail::scoped_jmpbuf scope(&buf, Signals);
+	int const sig = sigsetjmp(buf, 0);
+	if (sig != 0)
+	{
+		sig::detail::caught();
+		return sig::detail::result_type<Fun>{sig::in_error
+			, sig::errors::make_error_code(static_cast<sig::errors::error_code_enum>(sig))};
+	}
+
+	sig::detail::call_into(ret, f);
+	return ret;
+}
+
+// calls f(first[i]) for each element in the random access range [first, last)
+// under a single protection scope. If a signal is raised for an element, its
+// entry in status is set to the error and the batch resumes at the next
+// element. status must point to (last - first) error codes. Returns the number
+// of elements that failed
+template <unsigned Signals = catch_default, typename It, typename Fun>
+std::size_t try_signal_batch(It first, It last, std::error_code* status, Fun&& f)
+{
+	std::size_t const n = static_cast<std::size_t>(last - first);
+
+	// these are modified after sigsetjmp() and read after returning from it a
+	// second time, so they must not be cached in registers
+	std::size_t volatile i = 0;
+	std::size_t volatile failed = 0;
+
+	sigjmp_buf buf;
+	sig::detail::scoped_jmpbuf scope(&buf, Signals);
+	int const sig = sigsetjmp(buf, 0);
+	if (sig != 0)
+	{
+		sig::detail::caught();
+		status[i] = static_cast<sig::errors::error_code_enum>(sig);
+		failed = failed + 1;
+		i = i + 1;
+	}
+
+	while (i < n)
+	{
+		f(first[i]);
+		status[i] = std::error_code();
+		i = i + 1;
+	}
+	return failed;
 }
 
 }